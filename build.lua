@@ -8,6 +8,15 @@ module { name = 'opus',
          preprocessor = {
             'BE_OPUS_IMPL'
          }
+      },
+      app {
+         suffix = 'replay',
+         src = {
+            'tools/opus_replay.cpp'
+         },
+         link_project = {
+            'opus'
+         }
       }
    }
 }
@@ -5,30 +5,177 @@
 #include "handleable.hpp"
 #include <boost/function.hpp>
 #include <boost/container/vector.hpp>
+#include <boost/container/options.hpp>
+#include <cstddef>
 
 namespace be {
 namespace op {
 
 struct OpData;
+struct ActionTraits;
 class Op;
 class Opus;
 
+namespace detail {
+
+template <typename Action>
+struct TypedSet;
+
+struct ParallelSetState;
+
+} // be::op::detail
+
 inline void empty_op_func(OpData&, F64&) { }
 
 ///////////////////////////////////////////////////////////////////////////////
 struct OpData {
    using action_func = boost::function<void(OpData&, F64&)>;
-   using child_list_type = boost::container::vector<Op>;
+   using child_list_options = boost::container::vector_options_t<boost::container::stored_size<U32>>;
+   using child_list_type = boost::container::vector<Op, void, child_list_options>;
 
+   // hot: touched every time the op is run by a container
    F64 remaining = -1;
-   F64 total = 0;
    action_func action = empty_op_func;
    child_list_type children;
+   // incremented whenever the action, children, remaining or total values
+   // are changed through Op or the Opus
+   U32 revision = 0;
+
+   // cold: only touched by resets, fast-forwarding, cost tracking, and the Opus
+   F32 cost = 0;
+   F64 total = 0;
+   const ActionTraits* traits = nullptr;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+struct ActionTraits {
+   using advance_func = void(*)(OpData::action_func&, OpData&, F64&, F64);
+
+   using heap_size_func = std::size_t(*)(const OpData::action_func&);
+
+   using release_children_func = void(*)(OpData::action_func&, OpData&);
+
+   advance_func advance;
+   heap_size_func heap_size;
+   release_children_func release_children;
+};
+
+namespace detail {
+
+template <typename F, typename = void>
+struct HasAdvance : False { };
+
+template <typename F>
+struct HasAdvance<F, decltype(std::declval<F&>().advance(std::declval<OpData&>(), std::declval<F64&>(), F64()), void())> : True { };
+
+template <typename F, typename = void>
+struct HasHeapSize : False { };
+
+template <typename F>
+struct HasHeapSize<F, decltype(std::declval<const F&>().heap_size(), void())> : True { };
+
+template <typename F, typename = void>
+struct HasReleaseChildren : False { };
+
+template <typename F>
+struct HasReleaseChildren<F, decltype(std::declval<F&>().release_children(std::declval<OpData&>()), void())> : True { };
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Number of times ops have been invoked on the calling thread.
+///
+/// \details Incremented by Op::operator() and by containers which call
+///         actions directly; op::Opus reads the difference across a tick.
+inline U64& invocation_count() {
+   thread_local U64 count = 0;
+   return count;
+}
+
+U64 step(OpData::action_func& func, OpData& data, F64& dt, F64 step_size);
+U64 advance(OpData::action_func& func, const ActionTraits* traits, OpData& data, F64& dt, F64 step_size);
+std::size_t heap_size(const OpData::action_func& func, const ActionTraits* traits);
+void release_children(OpData::action_func& func, const ActionTraits* traits, OpData& data);
+
+template <typename F>
+void advance_thunk(OpData::action_func& func, OpData& data, F64& dt, F64 step_size) {
+   F* f = func.template target<F>();
+   if (f) {
+      f->advance(data, dt, step_size);
+   } else {
+      step(func, data, dt, step_size);
+   }
+}
+
+template <typename F>
+ActionTraits::advance_func advance_hook(True) {
+   return &advance_thunk<F>;
+}
+
+template <typename F>
+ActionTraits::advance_func advance_hook(False) {
+   return nullptr;
+}
+
+template <typename F>
+std::size_t owned_heap_size(const F& func, True) {
+   return func.heap_size();
+}
+
+template <typename F>
+std::size_t owned_heap_size(const F& func, False) {
+   BE_IGNORE(func);
+   return 0;
+}
+
+template <typename F>
+std::size_t heap_size_thunk(const OpData::action_func& func) {
+   const F* f = func.template target<F>();
+   if (!f) {
+      return 0;
+   }
+
+   std::size_t size = owned_heap_size(*f, HasHeapSize<F>());
+   if (!boost::detail::function::function_allows_small_object_optimization<F>::value) {
+      size += sizeof(F);
+   }
+   return size;
+}
+
+template <typename F>
+void release_children_thunk(OpData::action_func& func, OpData& data) {
+   F* f = func.template target<F>();
+   if (f) {
+      f->release_children(data);
+   }
+}
+
+template <typename F>
+ActionTraits::release_children_func release_children_hook(True) {
+   return &release_children_thunk<F>;
+}
+
+template <typename F>
+ActionTraits::release_children_func release_children_hook(False) {
+   return nullptr;
+}
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+const ActionTraits* action_traits() {
+   static const ActionTraits traits {
+      detail::advance_hook<F>(detail::HasAdvance<F>()),
+      &detail::heap_size_thunk<F>,
+      detail::release_children_hook<F>(detail::HasReleaseChildren<F>())
+   };
+   return &traits;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 class Op final : public Handleable<Op> {
    friend class Opus;
+   template <typename> friend struct detail::TypedSet;
+   friend struct detail::ParallelSetState;
    friend void swap(Op& a, Op& b) { a.swap_(b); }
 public:
    Op();
@@ -38,6 +185,10 @@ public:
 
    const OpData::action_func& action() const;
    void action(OpData::action_func func);
+   template <typename F>
+   void action(F func);
+
+   const ActionTraits* traits() const;
 
    F64 remaining() const;
    F64 remaining(F64 new_value);
@@ -45,13 +196,38 @@ public:
    F64 total() const;
    F64 total(F64 new_value);
 
+   F64 cost() const;
+
    void operator()(F64 dt);
+   void advance(F64& dt, F64 step_size);
 
 private:
    void swap_(Op& other);
    OpData data_;
 };
 
+// Size budgets: containers walk their children's Ops linearly, so growth
+// here directly increases the number of cache lines touched per tick.  The
+// hot members must lie within the first 64 bytes of OpData (including
+// padding); since Op's stride is not a multiple of 64, an op's hot members
+// may still straddle two cache lines, but never more.
+static_assert(offsetof(OpData, revision) + sizeof(OpData::revision) <= 64,
+              "Hot OpData members must lie within the first 64 bytes");
+static_assert(offsetof(OpData, revision) < offsetof(OpData, cost),
+              "Hot OpData members must precede cold ones");
+static_assert(sizeof(OpData) <= 80, "OpData exceeds its size budget");
+static_assert(sizeof(Op) <= 96, "Op exceeds its size budget");
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Sets the op's action, keeping track of its concrete type so that
+///         hooks like advance() can be found later.
+template <typename F>
+void Op::action(F func) {
+   data_.action = OpData::action_func(std::move(func));
+   data_.traits = action_traits<F>();
+   ++data_.revision;
+}
+
 } // be::op
 } // be
 
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef BE_CORE_OP_BUFFERED_STATE_HPP_
+#define BE_CORE_OP_BUFFERED_STATE_HPP_
+
+#include "op.hpp"
+#include <utility>
+
+namespace be {
+namespace op {
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+class BufferedStateBase {
+   friend class be::op::Opus;
+public:
+   virtual ~BufferedStateBase() { }
+
+private:
+   virtual void publish_() = 0;
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  A block of state with separate read and write buffers.
+///
+/// \details read() returns the state as it was published at the end of the
+///         previous tick and does not change while the Opus is running, so
+///         any number of ops may read it concurrently, in any order, and see
+///         the same values.  Writes go to write(), and become visible to
+///         readers when the Opus publishes the block at the end of the tick.
+///
+///         If carry_forward is true, the write buffer starts each tick as a
+///         copy of the newly published state, so ops only need to write the
+///         parts that change.  Otherwise the buffers are swapped, which
+///         avoids the copy, but leaves the write buffer holding the state
+///         from two ticks ago; every part of it must then be rewritten each
+///         tick.
+///
+///         Ops writing concurrently must write disjoint parts of the block.
+template <typename T>
+class BufferedState final : public detail::BufferedStateBase {
+public:
+   explicit BufferedState(T initial = T(), bool carry_forward = true)
+      : front_(initial),
+        back_(std::move(initial)),
+        carry_forward_(carry_forward)
+   { }
+
+   const T& read() const { return front_; }
+   T& write() { return back_; }
+
+   bool carry_forward() const { return carry_forward_; }
+   bool carry_forward(bool new_value) {
+      bool old_value = carry_forward_;
+      carry_forward_ = new_value;
+      return old_value;
+   }
+
+private:
+   void publish_() override {
+      if (carry_forward_) {
+         front_ = back_;
+      } else {
+         using std::swap;
+         swap(front_, back_);
+      }
+   }
+
+   T front_;
+   T back_;
+   bool carry_forward_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -3,6 +3,7 @@
 #define BE_CORE_OP_CONTAINERS_HPP_
 
 #include "op_functions.hpp"
+#include <vector>
 
 namespace be {
 namespace op {
@@ -10,18 +11,239 @@ namespace detail {
 
 struct Queue : OpFunc<Queue> {
    void operator()(OpData& data, F64& dt);
-   OpData::child_list_type::iterator position;
+   void advance(OpData& data, F64& dt, F64 step_size);
+   std::size_t position = 0;
    bool initialized = false;
 };
 
 struct Set : OpFunc<Set> {
    void operator()(OpData& data, F64& dt);
+   void advance(OpData& data, F64& dt, F64 step_size);
 };
 
 struct StaticSet : OpFunc<Set> {
    void operator()(OpData& data, F64& dt);
+   void advance(OpData& data, F64& dt, F64 step_size);
 };
 
+struct RoundRobin : OpFunc<RoundRobin> {
+   RoundRobin(std::size_t per_tick = 1, F64 budget = 0);
+   RoundRobin(const RoundRobin& other);
+   RoundRobin(RoundRobin&&) = default;
+   RoundRobin& operator=(const RoundRobin& other);
+   RoundRobin& operator=(RoundRobin&&) = default;
+   void operator()(OpData& data, F64& dt);
+   void advance(OpData& data, F64& dt, F64 step_size);
+   std::size_t heap_size() const;
+   void sync(OpData& data);
+   std::size_t per_tick;
+   F64 budget;
+   std::size_t position = 0;
+   F64 elapsed = 0;
+   U32 revision = 0;
+   std::vector<Handle<Op>> ops;
+   std::vector<F64> visited;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Placeholder action left in a child of an op::detail::TypedSet
+///         while the set holds the child's real action.
+///
+/// \details Does nothing if called; the Opus returns the real action to the
+///         child (see TypedSet::release_children()) before the child is run
+///         anywhere else.
+struct TypedSetEntry {
+   void operator()(OpData&, F64&) { }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Works like op::detail::Set, but stores its children's Action
+///         objects and remaining/total values contiguously and calls them
+///         directly, without going through OpData::action_func.
+///
+/// \details When the set's child list changes (the Opus increments its
+///         revision whenever a child is added, removed, or re-sorted), each
+///         child whose action is an Action and which has no children of its
+///         own has its action moved into the set's actions array, and a
+///         TypedSetEntry is left in its place.  Its remaining and total
+///         values are copied into parallel arrays.  Cached actions are
+///         called in child order with a stand-in OpData holding only
+///         remaining and total; any change to either is written back to the
+///         child, so Op::remaining() and Op::total() stay accurate.
+///
+///         Children are still ordinary ops, so priority(), erase() and
+///         reparenting work as usual.  Before the Opus moves a child out of
+///         the set, or wraps a child's action (e.g. to schedule it), it calls
+///         release_children(), which moves every cached action back into
+///         its child; the set re-caches on its next run.  Fast-forwarding
+///         does the same.  If a cached child's revision changes, the child
+///         is checked again: a new Action (set through Op::action()) is
+///         cached in place of the old one, new remaining/total values (set
+///         through Op::remaining() or Op::total()) are picked up, and a
+///         child which now has children of its own is given its action back.
+///         Children whose action is not an Action are called through their
+///         action_func, as in Set.  Assigning OpData::action directly does
+///         not change the revision, so it is not noticed; use Op::action().
+///
+///         Copies of a TypedSet start with no cached actions.
+template <typename Action>
+struct TypedSet : OpFunc<TypedSet<Action>> {
+   static constexpr U32 none = ~U32(0);
+
+   struct slot {
+      U32 revision;
+      U32 index;
+   };
+
+   TypedSet() { }
+   TypedSet(const TypedSet&) { }
+   TypedSet& operator=(const TypedSet&) {
+      release_children();
+      return *this;
+   }
+
+   ~TypedSet() {
+      release_children();
+   }
+
+   void operator()(OpData& data, F64& dt) {
+      if (!valid || revision != data.revision || slots.size() != data.children.size()) {
+         rebuild(data);
+      }
+
+      auto& children = data.children;
+      bool finished = true;
+      for (std::size_t i = 0, n = children.size(); i < n; ++i) {
+         OpData& child = children[i].data_;
+         slot& s = slots[i];
+         if (s.index != none && s.revision != child.revision) {
+            revalidate(child, s);
+         }
+
+         if (s.index != none) {
+            F64& r = remaining[s.index];
+            if (r != 0) {
+               finished = false;
+               F64& t = total[s.index];
+               stand_in.remaining = r;
+               stand_in.total = t;
+               F64 mdt = dt;
+               ++invocation_count();
+               actions[s.index](stand_in, mdt);
+               if (stand_in.remaining != r) {
+                  child.remaining = r = stand_in.remaining;
+               }
+               if (stand_in.total != t) {
+                  child.total = t = stand_in.total;
+               }
+            }
+         } else if (child.remaining != 0) {
+            finished = false;
+            F64 mdt = dt;
+            ++invocation_count();
+            child.action(child, mdt);
+         }
+      }
+      data.remaining = finished ? 0 : -1;
+   }
+
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      release_children(data);
+      bool finished = true;
+      for (Op& op : data.children) {
+         if (op.remaining() != 0) {
+            F64 mdt = dt;
+            op.advance(mdt, step_size);
+            if (op.remaining() != 0) {
+               finished = false;
+            }
+         }
+      }
+      data.remaining = finished ? 0 : -1;
+   }
+
+   void release_children(OpData& data) {
+      BE_IGNORE(data);
+      release_children();
+   }
+
+   void release_children() {
+      for (std::size_t i = 0; i < slots.size(); ++i) {
+         U32 index = slots[i].index;
+         Op* op = ops[i].get();
+         if (index != none && op && op->data_.action.template target<TypedSetEntry>()) {
+            op->data_.action = std::move(actions[index]);
+         }
+      }
+      actions.clear();
+      remaining.clear();
+      total.clear();
+      slots.clear();
+      ops.clear();
+      valid = false;
+   }
+
+   void rebuild(OpData& data) {
+      release_children();
+      slots.reserve(data.children.size());
+      ops.reserve(data.children.size());
+      for (Op& op : data.children) {
+         OpData& child = op.data_;
+         slot s { child.revision, none };
+         cache(child, s);
+         slots.push_back(s);
+         ops.push_back(static_cast<Handle<Op>>(op));
+      }
+      revision = data.revision;
+      valid = true;
+   }
+
+   void cache(OpData& child, slot& s) {
+      Action* action = child.children.empty() ? child.action.template target<Action>() : nullptr;
+      if (action) {
+         s.index = (U32)actions.size();
+         actions.push_back(std::move(*action));
+         remaining.push_back(child.remaining);
+         total.push_back(child.total);
+         child.action = TypedSetEntry();
+      }
+   }
+
+   void revalidate(OpData& child, slot& s) {
+      s.revision = child.revision;
+      if (!child.action.template target<TypedSetEntry>()) {
+         // replaced through Op::action(); cache the new action if possible
+         s.index = none;
+         cache(child, s);
+      } else if (!child.children.empty()) {
+         child.action = std::move(actions[s.index]);
+         s.index = none;
+      } else {
+         remaining[s.index] = child.remaining;
+         total[s.index] = child.total;
+      }
+   }
+
+   std::size_t heap_size() const {
+      return actions.capacity() * sizeof(Action)
+         + (remaining.capacity() + total.capacity()) * sizeof(F64)
+         + slots.capacity() * sizeof(slot)
+         + ops.capacity() * sizeof(Handle<Op>);
+   }
+
+   std::vector<Action> actions;
+   std::vector<F64> remaining;
+   std::vector<F64> total;
+   std::vector<slot> slots;
+   std::vector<Handle<Op>> ops;
+   OpData stand_in;
+   U32 revision = 0;
+   bool valid = false;
+};
+
+template <typename Action>
+constexpr U32 TypedSet<Action>::none;
+
 } // be::op::detail
 } // be::op
 } // be
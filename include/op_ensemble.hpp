@@ -0,0 +1,166 @@
+#pragma once
+#ifndef BE_CORE_OP_ENSEMBLE_HPP_
+#define BE_CORE_OP_ENSEMBLE_HPP_
+
+#include "opus.hpp"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace be {
+namespace op {
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+class EnsembleBlockBase {
+public:
+   virtual ~EnsembleBlockBase() { }
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  The state of one op across every instance of an op::Ensemble.
+///
+/// \details Each array holds one element per instance, so a kernel which
+///         loops over instances touches contiguous memory and can be
+///         vectorized.
+template <typename State>
+struct EnsembleBlock final : detail::EnsembleBlockBase {
+   EnsembleBlock(std::size_t instances, const State& initial, F64 remaining, F64 total)
+      : remaining(instances, remaining),
+        total(instances, total),
+        state(instances, initial)
+   { }
+
+   std::size_t size() const {
+      return state.size();
+   }
+
+   std::size_t heap_size() const {
+      return (remaining.capacity() + total.capacity()) * sizeof(F64) + state.capacity() * sizeof(State);
+   }
+
+   std::vector<F64> remaining;
+   std::vector<F64> total;
+   std::vector<State> state;
+};
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Calls Kernel once per tick with the state of every instance.
+///
+/// \details The op is complete (remaining == 0) once every instance's
+///         remaining value is 0, so containers like op::detail::Queue only
+///         move on when all instances are done.  Kernels should skip
+///         instances which have already completed.  Copies of a Batched
+///         action share the same block.
+template <typename State, typename Kernel>
+struct Batched : OpFunc<Batched<State, Kernel>>, Kernel {
+   Batched(std::shared_ptr<EnsembleBlock<State>> block, Kernel kernel = Kernel())
+      : Kernel(std::move(kernel)),
+        block(std::move(block))
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      EnsembleBlock<State>& b = *block;
+      static_cast<Kernel&>(*this)(b, dt);
+
+      bool finished = true;
+      for (F64 remaining : b.remaining) {
+         if (remaining != 0) {
+            finished = false;
+            break;
+         }
+      }
+      data.remaining = finished ? 0 : -1;
+   }
+
+   std::size_t heap_size() const {
+      return block->heap_size();
+   }
+
+   std::shared_ptr<EnsembleBlock<State>> block;
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+class Ensemble final {
+public:
+   explicit Ensemble(std::size_t instances, std::function<Op(Id)> op_gen = default_op_generator);
+
+   Ensemble(const Ensemble&) = delete;
+   Ensemble& operator=(const Ensemble&) = delete;
+
+   std::size_t instances() const;
+   Opus& opus();
+
+   F64 operator()(F64 dt);
+
+   template <typename State, typename Kernel>
+   Op& child(Id parent_id, Id child_id, I32 priority, Kernel kernel, const State& initial = State(), F64 remaining = -1, F64 total = 0);
+
+   template <typename State>
+   EnsembleBlock<State>* block(Id id);
+
+private:
+   using block_map = std::unordered_map<Id, std::weak_ptr<detail::EnsembleBlockBase>>;
+
+   void prune_();
+
+   std::size_t instances_;
+   Opus opus_;
+   block_map blocks_;
+   std::size_t prune_at_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Creates an op whose kernel updates the state of every instance.
+///
+/// \details kernel is called as kernel(EnsembleBlock<State>&, F64& dt) once
+///         per tick, after the ensemble's shared structure has been cleaned,
+///         just like any other action.  Ops which do not need per-instance
+///         state (containers, for example) can be created directly through
+///         opus(); they are run once per tick on behalf of every instance.
+template <typename State, typename Kernel>
+Op& Ensemble::child(Id parent_id, Id child_id, I32 priority, Kernel kernel, const State& initial, F64 remaining, F64 total) {
+   if (blocks_.size() >= prune_at_) {
+      prune_();
+   }
+
+   auto block = std::make_shared<EnsembleBlock<State>>(instances_, initial, remaining, total);
+   blocks_[child_id] = block;
+
+   Op& op = opus_.child(parent_id, child_id, priority);
+   op.action(detail::Batched<State, Kernel>(std::move(block), std::move(kernel)));
+   op.remaining(remaining);
+   op.total(total);
+   return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Retrieves the per-instance state of an op created with child(),
+///         or nullptr if the op no longer exists or State is not the type it
+///         was created with.
+template <typename State>
+EnsembleBlock<State>* Ensemble::block(Id id) {
+   auto it = blocks_.find(id);
+   if (it == blocks_.end()) {
+      return nullptr;
+   }
+
+   auto ptr = it->second.lock();
+   if (!ptr) {
+      blocks_.erase(it);
+      return nullptr;
+   }
+
+   return dynamic_cast<EnsembleBlock<State>*>(ptr.get());
+}
+
+} // be::op
+} // be
+
+#endif
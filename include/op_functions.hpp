@@ -3,9 +3,97 @@
 #define BE_CORE_OP_FUNCTIONS_HPP_
 
 #include "op.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
 
 namespace be {
 namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+struct TimeDomain {
+   F64 scale = 1;
+   bool paused = false;
+   std::function<F64()> scale_func;
+
+   F64 factor = 1;
+   F64 dt = 0;
+   F64 clock = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  A budget of arbitrary units (bytes uploaded, raycasts, etc.)
+///         which is refilled once per tick by op::detail::Consumable.
+///
+/// \details Drawing is lock-free and may be done from any thread.  When
+///         refilled, up to carry_limit units left over from the previous tick
+///         are added to the new budget.
+class Quota final {
+public:
+   explicit Quota(F64 budget = 0, F64 carry_limit = 0)
+      : budget_(budget),
+        carry_limit_(carry_limit),
+        balance_(budget)
+   { }
+
+   Quota(const Quota&) = delete;
+   Quota& operator=(const Quota&) = delete;
+
+   F64 budget() const { return budget_; }
+   F64 budget(F64 new_value) {
+      F64 old_value = budget_;
+      budget_ = new_value;
+      return old_value;
+   }
+
+   F64 carry_limit() const { return carry_limit_; }
+   F64 carry_limit(F64 new_value) {
+      F64 old_value = carry_limit_;
+      carry_limit_ = new_value;
+      return old_value;
+   }
+
+   F64 available() const {
+      return balance_.load(std::memory_order_relaxed);
+   }
+
+   /// Draws amount units if that many are available.  Returns false (and
+   /// draws nothing) otherwise.
+   bool try_draw(F64 amount) {
+      F64 balance = balance_.load(std::memory_order_relaxed);
+      do {
+         if (balance < amount) {
+            return false;
+         }
+      } while (!balance_.compare_exchange_weak(balance, balance - amount, std::memory_order_relaxed));
+      return true;
+   }
+
+   /// Draws as many units as are available, up to amount.  Returns the
+   /// number of units drawn.
+   F64 draw_up_to(F64 amount) {
+      F64 balance = balance_.load(std::memory_order_relaxed);
+      F64 drawn;
+      do {
+         drawn = std::max(0.0, std::min(balance, amount));
+      } while (!balance_.compare_exchange_weak(balance, balance - drawn, std::memory_order_relaxed));
+      return drawn;
+   }
+
+   /// Must not be called concurrently with itself or the setters.
+   void refill() {
+      F64 leftover = std::max(0.0, std::min(balance_.load(std::memory_order_relaxed), carry_limit_));
+      balance_.store(budget_ + leftover, std::memory_order_relaxed);
+   }
+
+private:
+   F64 budget_;
+   F64 carry_limit_;
+   std::atomic<F64> balance_;
+};
+
 namespace detail {
 
 template <typename T>
@@ -14,6 +102,20 @@ struct OpFunc {
    operator const T&() const { return static_cast<const T&>(*this); }
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Base for op functions which must not be copied when the op
+///         holding them is moved.
+///
+/// \details boost::function stores functors which fit in its small buffer
+///         in place, and moves them by copying and then destroying the
+///         original, so a move can't be told apart from a copy.  Larger
+///         functors are allocated on the heap and moved by pointer; this
+///         padding keeps the functor out of the small buffer, so copy
+///         constructors are only used for real copies (e.g. prefabs).
+struct HeapStored {
+   char heap_stored_padding[sizeof(boost::detail::function::function_buffer)] = { };
+};
+
 struct Empty : OpFunc<Empty> {
    void operator()(OpData& data, F64& dt) {
       BE_IGNORE2(data, dt);
@@ -28,6 +130,65 @@ enum class DtConsumptionPolicy {
 template <DtConsumptionPolicy Value>
 using DtConsumptionTag = Tag<DtConsumptionPolicy, Value>;
 
+inline void consume_dt(F64& dt, F64 unused, DtConsumptionTag<DtConsumptionPolicy::disable>) {
+   BE_IGNORE2(dt, unused);
+}
+
+inline void consume_dt(F64& dt, F64 unused, DtConsumptionTag<DtConsumptionPolicy::consume>) {
+   dt = unused;
+}
+
+inline void consume_dt(F64& dt, F64 unused, DtConsumptionTag<DtConsumptionPolicy::consume_all>) {
+   BE_IGNORE(unused);
+   dt = 0;
+}
+
+template <typename F>
+struct CanAdvance : std::integral_constant<bool, HasAdvance<F>::value || std::is_same<F, OpData::action_func>::value> { };
+
+template <typename F>
+void advance_inner(F& func, const ActionTraits* traits, OpData& data, F64& dt, F64 step_size) {
+   BE_IGNORE(traits);
+   func.advance(data, dt, step_size);
+}
+
+inline void advance_inner(OpData::action_func& func, const ActionTraits* traits, OpData& data, F64& dt, F64 step_size) {
+   advance(func, traits, data, dt, step_size);
+}
+
+template <typename F>
+struct CanReleaseChildren : std::integral_constant<bool, HasReleaseChildren<F>::value || std::is_same<F, OpData::action_func>::value> { };
+
+template <typename F>
+void release_children_inner(F& func, const ActionTraits* traits, OpData& data) {
+   BE_IGNORE(traits);
+   func.release_children(data);
+}
+
+inline void release_children_inner(OpData::action_func& func, const ActionTraits* traits, OpData& data) {
+   release_children(func, traits, data);
+}
+
+
+const F64 default_cost_weight = 0.125;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Folds a new measurement into an op's cost estimate.
+///
+/// \details The first measurement replaces the estimate outright; after
+///         that, each measurement moves the estimate weight of the way
+///         towards it.  Overridden costs (stored as negative values; see
+///         op::Opus::cost(Id, F64)) are left alone.
+inline void record_cost(OpData& data, F64 seconds, F64 weight) {
+   if (std::signbit(data.cost)) {
+      return;
+   }
+   if (data.cost == 0) {
+      data.cost = (F32)seconds;
+   } else {
+      data.cost = (F32)(data.cost + (seconds - data.cost) * weight);
+   }
+}
 
 template <typename F>
 struct Wrap : OpFunc<Wrap<F>>, F {
@@ -63,6 +224,12 @@ struct PostSetCompleted : OpFunc<PostSetCompleted<F>>, F {
       static_cast<F&>(*this)(data, dt);
       data.remaining = 0;
    }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+      data.remaining = 0;
+   }
 };
 
 template <typename F>
@@ -86,6 +253,11 @@ struct Resettable : OpFunc<Resettable<F>>, F {
       }
       static_cast<F&>(*this)(data, dt);
    }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+   }
 };
 
 template <typename F, I64 Numer = 1, I64 Denom = 1>
@@ -98,6 +270,11 @@ struct StaticResettable : OpFunc<StaticResettable<F, Numer, Denom>>, F {
       }
       static_cast<F&>(*this)(data, dt);
    }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+   }
 };
 
 template <typename F, typename ValueType = F64>
@@ -113,6 +290,11 @@ struct StatefulResettable : OpFunc<StatefulResettable<F, ValueType>>, F {
       }
       static_cast<F&>(*this)(data, dt);
    }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+   }
    ValueType val;
 };
 
@@ -129,6 +311,11 @@ struct DynamicResettable : OpFunc<DynamicResettable<F, ValueFunc>>, F, ValueFunc
       }
       static_cast<F&>(*this)(data, dt);
    }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+   }
 };
 
 template <typename F, I64 Numer, I64 Denom = 1, DtConsumptionPolicy Dtcp = DtConsumptionPolicy::consume>
@@ -139,6 +326,14 @@ struct StaticTimestretch : OpFunc<StaticTimestretch<F, Numer, Denom, Dtcp>>, F {
       exec(data, dt, DtConsumptionTag<Dtcp>());
    }
 
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      constexpr const F64 f = Numer / (F64)Denom;
+      F64 mdt = dt * f;
+      static_cast<G&>(*this).advance(data, mdt, step_size * f);
+      consume_dt(dt, mdt / f, DtConsumptionTag<Dtcp>());
+   }
+
    void exec(OpData& data, F64& dt, DtConsumptionTag<DtConsumptionPolicy::disable>) {
       constexpr const F64 f = Numer / (F64)Denom;
       F64 mdt = dt * f;
@@ -171,6 +366,13 @@ struct StatefulTimestretch : OpFunc<StatefulTimestretch<F, ValueType, Dtcp>>, F
       exec(data, dt, DtConsumptionTag<Dtcp>());
    }
 
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      F64 mdt = dt * factor;
+      static_cast<G&>(*this).advance(data, mdt, step_size * factor);
+      consume_dt(dt, mdt / factor, DtConsumptionTag<Dtcp>());
+   }
+
    void exec(OpData& data, F64& dt, DtConsumptionTag<DtConsumptionPolicy::disable>) {
       F64 mdt = dt * factor;
       static_cast<F&>(*this)(data, mdt);
@@ -221,11 +423,243 @@ struct DynamicTimestretch : OpFunc<DynamicTimestretch<F, FactorFunc, Dtcp>>, F,
    }
 };
 
-// TODO interpolator
-// TODO delay
+template <typename F>
+struct DomainBound : OpFunc<DomainBound<F>>, F {
+   DomainBound(std::shared_ptr<const TimeDomain> domain, F func = F())
+      : F(std::move(func)),
+        domain(std::move(domain))
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (dt == 0) {
+         static_cast<F&>(*this)(data, dt);
+         return;
+      }
+
+      const F64 f = domain->factor;
+      if (f == 0) {
+         return;
+      }
+
+      F64 mdt = dt * f;
+      static_cast<F&>(*this)(data, mdt);
+      dt = mdt / f;
+   }
+
+   template <typename G = F, typename = std::enable_if_t<CanAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      const F64 f = domain->factor;
+      if (f == 0) {
+         return;
+      }
+
+      F64 mdt = dt * f;
+      advance_inner(static_cast<G&>(*this), inner_traits, data, mdt, step_size * f);
+      dt = mdt / f;
+   }
+
+   template <typename G = F, typename = std::enable_if_t<std::is_same<G, OpData::action_func>::value>>
+   std::size_t heap_size() const {
+      return detail::heap_size(static_cast<const G&>(*this), inner_traits);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<CanReleaseChildren<G>::value>>
+   void release_children(OpData& data) {
+      release_children_inner(static_cast<G&>(*this), inner_traits, data);
+   }
+
+   std::shared_ptr<const TimeDomain> domain;
+   const ActionTraits* inner_traits = nullptr;
+};
+
+template <typename F>
+struct Scheduled : OpFunc<Scheduled<F>>, F {
+   Scheduled(F func = F(), U32 divisor = 1, F64 interval = 0)
+      : F(std::move(func)),
+        divisor(divisor),
+        interval(interval)
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (dt == 0) {
+         static_cast<F&>(*this)(data, dt);
+         return;
+      }
+
+      accumulated += dt;
+
+      if (interval > 0) {
+         elapsed += dt;
+         if (elapsed < interval) {
+            return;
+         }
+         elapsed -= interval;
+         if (elapsed >= interval) {
+            elapsed = 0;
+         }
+      }
+
+      if (countdown > 0) {
+         --countdown;
+         return;
+      }
+      countdown = divisor > 0 ? divisor - 1 : 0;
+
+      F64 mdt = accumulated;
+      accumulated = 0;
+      static_cast<F&>(*this)(data, mdt);
+      dt = std::min(dt, mdt);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<CanAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      F64 mdt = accumulated + dt;
+      accumulated = 0;
+      advance_inner(static_cast<G&>(*this), inner_traits, data, mdt, step_size);
+      dt = std::min(dt, mdt);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<std::is_same<G, OpData::action_func>::value>>
+   std::size_t heap_size() const {
+      return detail::heap_size(static_cast<const G&>(*this), inner_traits);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<CanReleaseChildren<G>::value>>
+   void release_children(OpData& data) {
+      release_children_inner(static_cast<G&>(*this), inner_traits, data);
+   }
+
+   U32 divisor;
+   U32 countdown = 0;
+   F64 interval;
+   F64 elapsed = 0;
+   F64 accumulated = 0;
+   const ActionTraits* inner_traits = nullptr;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Measures how long F takes to run and records it as the op's cost
+///         (see op::Op::cost()).
+///
+/// \details Resets and fast-forwarding are not measured.
+template <typename F>
+struct Measured : OpFunc<Measured<F>>, F {
+   Measured(F func = F(), F64 weight = default_cost_weight)
+      : F(std::move(func)),
+        weight(weight)
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (dt == 0) {
+         static_cast<F&>(*this)(data, dt);
+         return;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      static_cast<F&>(*this)(data, dt);
+      record_cost(data, std::chrono::duration<F64>(std::chrono::steady_clock::now() - start).count(), weight);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<HasAdvance<G>::value>>
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      static_cast<G&>(*this).advance(data, dt, step_size);
+   }
+
+   template <typename G = F, typename = std::enable_if_t<HasReleaseChildren<G>::value>>
+   void release_children(OpData& data) {
+      static_cast<G&>(*this).release_children(data);
+   }
+
+   F64 weight;
+};
+
+struct Delay : OpFunc<Delay> {
+   void operator()(OpData& data, F64& dt) {
+      if (data.remaining > dt) {
+         data.remaining -= dt;
+         dt = 0;
+      } else {
+         dt -= std::max(data.remaining, 0.0);
+         data.remaining = 0;
+      }
+   }
+
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      BE_IGNORE(step_size);
+      (*this)(data, dt);
+   }
+};
+
+template <typename F>
+struct Interpolate : OpFunc<Interpolate<F>>, F {
+   Interpolate(F func = F()) : F(std::move(func)) { }
+
+   void operator()(OpData& data, F64& dt) {
+      Delay()(data, dt);
+      static_cast<F&>(*this)(data.total > 0 ? 1 - data.remaining / data.total : 1);
+   }
+
+   void advance(OpData& data, F64& dt, F64 step_size) {
+      BE_IGNORE(step_size);
+      (*this)(data, dt);
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Refills a quota each time it is run, then runs F (usually a
+///         container, like op::detail::Set), whose descendants draw from the
+///         quota.
+///
+/// \details Resets (dt == 0) are passed through without refilling.  There is
+///         no advance() hook, so fast-forwarding steps this op, refilling the
+///         quota once per step, just as it would be during normal play.
+template <typename F>
+struct Consumable : OpFunc<Consumable<F>>, F {
+   Consumable(std::shared_ptr<Quota> quota, F func = F())
+      : F(std::move(func)),
+        quota(std::move(quota))
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (dt != 0) {
+         quota->refill();
+      }
+      static_cast<F&>(*this)(data, dt);
+   }
+
+   std::shared_ptr<Quota> quota;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Runs F only if cost units can be drawn from a quota.
+///
+/// \details When the quota is exhausted, F is not called and dt is not
+///         consumed.  Unless the op has already finished, its remaining value
+///         is set to -1 so that containers treat it as unfinished, and it
+///         tries again next time it is run.  Actions with variable costs can
+///         instead call Quota::try_draw() or Quota::draw_up_to() directly.
+template <typename F>
+struct Consume : OpFunc<Consume<F>>, F {
+   Consume(std::shared_ptr<Quota> quota, F64 cost, F func = F())
+      : F(std::move(func)),
+        quota(std::move(quota)),
+        cost(cost)
+   { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (dt == 0 || quota->try_draw(cost)) {
+         static_cast<F&>(*this)(data, dt);
+      } else if (data.remaining != 0) {
+         data.remaining = -1;
+      }
+   }
+
+   std::shared_ptr<Quota> quota;
+   F64 cost;
+};
+
 // TODO timedWrap
 // TODO perftimed
-// TODO consumable
 
 
 } // be::op::detail
@@ -0,0 +1,151 @@
+#pragma once
+#ifndef BE_CORE_OP_PARALLEL_HPP_
+#define BE_CORE_OP_PARALLEL_HPP_
+
+#include "op_functions.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+class WorkerPool final {
+public:
+   using task = std::function<void()>;
+
+   explicit WorkerPool(std::size_t threads = default_size());
+   ~WorkerPool();
+
+   WorkerPool(const WorkerPool&) = delete;
+   WorkerPool& operator=(const WorkerPool&) = delete;
+
+   std::size_t size() const;
+
+   void post(task t);
+   bool run_one();
+
+   static std::size_t default_size();
+
+private:
+   bool pop_(task& t);
+   void run_();
+
+   std::vector<std::thread> threads_;
+   std::deque<task> tasks_;
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   bool stopping_;
+};
+
+enum class ParallelForMode {
+   blocking,
+   background
+};
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+struct ParallelForState {
+   using chunk_func = std::function<void(std::size_t, std::size_t)>;
+
+   WorkerPool* pool;
+   chunk_func kernel;
+   std::size_t begin;
+   std::size_t end;
+   std::size_t per_tick;
+   std::size_t grain;
+   ParallelForMode mode;
+
+   std::atomic<std::size_t> next;
+   std::atomic<std::size_t> completed;
+   std::atomic<std::size_t> pending;
+   std::size_t limit;
+   bool started = false;
+
+   bool grab(std::size_t limit, std::size_t& chunk_begin, std::size_t& chunk_end);
+   void work(std::size_t limit);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct ParallelFor : OpFunc<ParallelFor>, HeapStored {
+   using chunk_func = ParallelForState::chunk_func;
+
+   ParallelFor(WorkerPool& pool, std::size_t begin, std::size_t end, chunk_func kernel,
+               ParallelForMode mode = ParallelForMode::blocking, std::size_t per_tick = 0, std::size_t grain = 1);
+   ParallelFor(const ParallelFor& other);
+   ParallelFor(ParallelFor&&) = default;
+   ParallelFor& operator=(const ParallelFor& other);
+   ParallelFor& operator=(ParallelFor&&) = default;
+
+   void operator()(OpData& data, F64& dt);
+   std::shared_ptr<ParallelForState> state;
+
+private:
+   void start_(std::size_t limit);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct ParallelSetState {
+   struct batch {
+      std::size_t begin;
+      std::size_t end;
+   };
+
+   std::vector<Op*> ops;
+   std::vector<batch> batches;
+   F64 dt = 0;
+   F64 weight = default_cost_weight;
+
+   std::atomic<std::size_t> next { 0 };
+   std::atomic<std::size_t> pending { 0 };
+   std::atomic<U64> invocations { 0 };
+
+   void plan(OpData& data, std::size_t workers);
+   void work();
+   void work_task();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct ParallelSet : OpFunc<ParallelSet> {
+   explicit ParallelSet(WorkerPool& pool, F64 weight = default_cost_weight);
+   ParallelSet(const ParallelSet& other);
+   ParallelSet& operator=(const ParallelSet& other);
+
+   void operator()(OpData& data, F64& dt);
+   void advance(OpData& data, F64& dt, F64 step_size);
+
+   WorkerPool* pool;
+   F64 weight;
+   std::shared_ptr<ParallelSetState> state;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+struct ForEachElement : F {
+   ForEachElement(F func = F()) : F(std::move(func)) { }
+   void operator()(std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+         static_cast<F&>(*this)(i);
+      }
+   }
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+detail::ForEachElement<F> for_each_element(F func) {
+   return detail::ForEachElement<F>(std::move(func));
+}
+
+} // be::op
+} // be
+
+#endif
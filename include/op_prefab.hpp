@@ -0,0 +1,66 @@
+#pragma once
+#ifndef BE_CORE_OP_PREFAB_HPP_
+#define BE_CORE_OP_PREFAB_HPP_
+
+#include "op_containers.hpp"
+#include <vector>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+class Prefab final {
+   friend class Opus;
+   struct node {
+      Id id;
+      Id parent;
+      I32 priority = 0;
+      F64 remaining = -1;
+      F64 total = 0;
+      OpData::action_func action;
+      const ActionTraits* traits = nullptr;
+      Id watch;
+      std::size_t first_child = 0;
+      std::size_t child_count = 0;
+   };
+   using node_list = std::vector<node>;
+public:
+   Prefab();
+   Prefab(OpData::action_func root_action, F64 remaining = -1, F64 total = 0);
+   template <typename F>
+   Prefab(F root_action, F64 remaining = -1, F64 total = 0);
+
+   void child(Id parent_id, Id child_id, I32 priority, OpData::action_func action, F64 remaining = -1, F64 total = 0);
+   template <typename F>
+   void child(Id parent_id, Id child_id, I32 priority, F action, F64 remaining = -1, F64 total = 0);
+
+   std::size_t size() const;
+
+   static Id id(Id instance_id, Id relative_id);
+
+private:
+   void seal_();
+
+   node_list nodes_;
+   bool sealed_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+Prefab::Prefab(F root_action, F64 remaining, F64 total)
+   : Prefab(OpData::action_func(std::move(root_action)), remaining, total)
+{
+   nodes_.front().traits = action_traits<F>();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void Prefab::child(Id parent_id, Id child_id, I32 priority, F action, F64 remaining, F64 total) {
+   child(parent_id, child_id, priority, OpData::action_func(std::move(action)), remaining, total);
+   nodes_.back().traits = action_traits<F>();
+}
+
+} // be::op
+} // be
+
+#endif
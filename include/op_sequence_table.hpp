@@ -0,0 +1,267 @@
+#pragma once
+#ifndef BE_CORE_OP_SEQUENCE_TABLE_HPP_
+#define BE_CORE_OP_SEQUENCE_TABLE_HPP_
+
+#include "op_functions.hpp"
+#include <memory>
+#include <vector>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  The progress of a single step in an op::SequenceTable; plays the
+///         role that OpData plays for an op.
+struct SequenceStepData {
+   F64 remaining;
+   F64 total;
+};
+
+using SequenceStepFunc = boost::function<void(SequenceStepData&, F64&)>;
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Bookkeeping shared by every op::SequenceTable, independent of its
+///         step type.
+///
+/// \details Sequences and steps are identified by indices into flat arrays.
+///         Each sequence is a singly linked chain of steps, so steps can be
+///         appended to any sequence without moving other sequences' steps.
+///         Freed sequence and step slots are reused.  active holds every
+///         sequence which may still have work left; in_active[s] is non-zero
+///         exactly when s appears in it (once).
+struct SequenceIndex {
+   static constexpr U32 none = ~U32(0);
+
+   // per sequence
+   std::vector<U32> first;
+   std::vector<U32> last;
+   std::vector<U32> cursor;
+   std::vector<U8> live;
+   std::vector<U8> in_active;
+
+   // per step
+   std::vector<U32> next;
+
+   std::vector<U32> active;
+   std::vector<U32> free_sequences;
+   U32 free_steps = none;
+   std::size_t step_count = 0;
+
+   U32 create();
+   U32 append(U32 sequence);
+   U32 clear(U32 sequence);
+   void release(U32 steps);
+   void erase(U32 sequence);
+   void rewind(U32 sequence);
+   void rewind();
+   bool valid(U32 sequence) const;
+   bool finished(U32 sequence) const;
+   std::size_t heap_size() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename Step>
+struct SequenceTableState : SequenceIndex {
+   std::vector<Step> steps;
+   std::vector<SequenceStepData> data;
+
+   std::size_t heap_size() const {
+      return SequenceIndex::heap_size() + steps.capacity() * sizeof(Step) + data.capacity() * sizeof(SequenceStepData);
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Runs every active sequence in an op::SequenceTable.
+///
+/// \details Each sequence works like op::detail::Queue: its current step is
+///         called with a copy of dt, and it moves on to the next step when
+///         the current one's remaining time reaches 0, continuing as long
+///         as there is dt left.  Sequences which have run out of steps are
+///         dropped from the active list, so they cost nothing until a step
+///         is appended to them.  The order in which sequences run is
+///         unspecified.
+///
+///         While any sequence has steps left, the op's remaining() time will
+///         be -1; once they have all finished it will be set to 0.  When
+///         called with a dt of 0, every sequence is rewound to its first
+///         step, just as Queue rewinds to its first child.
+///
+///         Steps are called directly as Step, so when Step is a concrete
+///         functor type rather than SequenceStepFunc, the whole table is
+///         advanced in one loop without any indirect calls.
+template <typename Step>
+struct SequenceTableQueue : OpFunc<SequenceTableQueue<Step>> {
+   SequenceTableQueue(std::shared_ptr<SequenceTableState<Step>> state) : state(std::move(state)) { }
+
+   void operator()(OpData& data, F64& dt) {
+      SequenceTableState<Step>& s = *state;
+
+      if (dt == 0) {
+         s.rewind();
+         data.remaining = s.active.empty() ? 0 : -1;
+         return;
+      }
+
+      std::size_t out = 0;
+      for (std::size_t i = 0, n = s.active.size(); i < n; ++i) {
+         U32 sequence = s.active[i];
+         U32 cur = s.cursor[sequence];
+
+         F64 sdt = dt;
+         while (cur != SequenceIndex::none) {
+            SequenceStepData& step = s.data[cur];
+            if (step.remaining) {
+               s.steps[cur](step, sdt);
+               if (step.remaining) {
+                  break;
+               }
+            }
+            cur = s.next[cur];
+            if (sdt <= 0) {
+               break;
+            }
+         }
+
+         s.cursor[sequence] = cur;
+         if (cur != SequenceIndex::none) {
+            s.active[out++] = sequence;
+         } else {
+            s.in_active[sequence] = 0;
+         }
+      }
+      s.active.resize(out);
+
+      data.remaining = out == 0 ? 0 : -1;
+   }
+
+   std::size_t heap_size() const {
+      return state->heap_size();
+   }
+
+   std::shared_ptr<SequenceTableState<Step>> state;
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Stores many independent sequences of steps in flat arrays and
+///         runs all of them from a single op.
+///
+/// \details A replacement for large numbers of small op::detail::Queue ops,
+///         such as per-entity scripted sequences.  Instead of an op (with
+///         its own child list and action_func) per step, each step is a Step
+///         object and a SequenceStepData record in contiguous arrays, and
+///         each sequence is a cursor into them.
+///
+///         Use action() to create the op function which runs the table.  The
+///         SequenceTable object and any op functions created from it share
+///         ownership of the table.  Unlike op::Stream, a SequenceTable may
+///         only be used from the thread running the Opus, and steps must not
+///         be appended to a table from inside one of its own steps.
+///
+///         Step must be default constructible, and is called as
+///         step(SequenceStepData&, F64& dt).
+template <typename Step = SequenceStepFunc>
+class SequenceTable final {
+public:
+   SequenceTable() : state_(std::make_shared<detail::SequenceTableState<Step>>()) { }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Creates a new, empty sequence and returns its index.
+   ///
+   /// \details Indices of erased sequences are reused.
+   U32 create() {
+      return state_->create();
+   }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Adds a step to the end of a sequence.
+   ///
+   /// \details If the sequence had already finished, it will resume with
+   ///         this step on the next tick.  No allocation takes place unless
+   ///         the table's arrays need to grow.
+   void append(U32 sequence, Step step, F64 remaining = -1, F64 total = 0) {
+      detail::SequenceTableState<Step>& s = *state_;
+      U32 index = s.append(sequence);
+      if (index == s.steps.size()) {
+         s.steps.push_back(std::move(step));
+         s.data.push_back(SequenceStepData { remaining, total });
+      } else {
+         s.steps[index] = std::move(step);
+         s.data[index] = SequenceStepData { remaining, total };
+      }
+   }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Removes every step from a sequence, without removing the
+   ///         sequence itself.
+   void clear(U32 sequence) {
+      release_(state_->clear(sequence));
+   }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Removes a sequence and all of its steps.
+   void erase(U32 sequence) {
+      release_(state_->clear(sequence));
+      state_->erase(sequence);
+   }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Moves a sequence's cursor back to its first step.
+   ///
+   /// \details Like a Queue's children, steps keep their remaining() time,
+   ///         so steps which have already completed will be skipped unless
+   ///         their data is reset.
+   void rewind(U32 sequence) {
+      state_->rewind(sequence);
+   }
+
+   bool finished(U32 sequence) const {
+      return state_->finished(sequence);
+   }
+
+   ///////////////////////////////////////////////////////////////////////////
+   /// \brief  Returns the data for the step a sequence is currently on, or
+   ///         nullptr if the sequence has finished.
+   SequenceStepData* current(U32 sequence) {
+      detail::SequenceTableState<Step>& s = *state_;
+      if (!s.valid(sequence) || s.cursor[sequence] == detail::SequenceIndex::none) {
+         return nullptr;
+      }
+      return &s.data[s.cursor[sequence]];
+   }
+
+   std::size_t sequences() const {
+      return state_->first.size() - state_->free_sequences.size();
+   }
+
+   std::size_t active() const {
+      return state_->active.size();
+   }
+
+   std::size_t steps() const {
+      return state_->step_count;
+   }
+
+   detail::SequenceTableQueue<Step> action() const {
+      return detail::SequenceTableQueue<Step>(state_);
+   }
+
+private:
+   void release_(U32 steps) {
+      detail::SequenceTableState<Step>& s = *state_;
+      for (U32 i = steps; i != detail::SequenceIndex::none; i = s.next[i]) {
+         s.steps[i] = Step();
+      }
+      s.release(steps);
+   }
+
+   std::shared_ptr<detail::SequenceTableState<Step>> state_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef BE_CORE_OP_SIGNAL_HPP_
+#define BE_CORE_OP_SIGNAL_HPP_
+
+#include "op_functions.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace be {
+namespace op {
+namespace detail {
+
+struct WaitFor;
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+class Signal final {
+   friend class Opus;
+   friend struct detail::WaitFor;
+public:
+   explicit Signal(std::shared_ptr<std::atomic<Signal*>> fired_list);
+
+   Signal(const Signal&) = delete;
+   Signal& operator=(const Signal&) = delete;
+
+   void fire();
+   std::size_t waiting() const;
+   U64 wakes() const;
+
+private:
+   using waiter_list = std::vector<std::pair<Id, Op>>;
+   using watcher_list = std::vector<std::pair<Id, U64>>;
+
+   void watch_(Id id);
+   void unwatch_(Id id);
+
+   std::shared_ptr<std::atomic<Signal*>> fired_;
+   std::atomic<bool> queued_;
+   std::atomic<U64> fires_;
+   std::atomic<U64> wakes_;
+   Signal* next_;
+   waiter_list waiters_;
+   mutable std::mutex watchers_mutex_;
+   watcher_list watchers_;
+};
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+struct WaitFor : OpFunc<WaitFor> {
+   WaitFor(std::shared_ptr<Signal> signal, Id id);
+   void operator()(OpData& data, F64& dt);
+   void advance(OpData& data, F64& dt, F64 step_size);
+   std::shared_ptr<Signal> signal;
+   Id id;
+   U32 revision = 0;
+   bool armed = false;
+};
+
+} // be::op::detail
+} // be::op
+} // be
+
+#endif
@@ -0,0 +1,238 @@
+#pragma once
+#ifndef BE_CORE_OP_STREAM_HPP_
+#define BE_CORE_OP_STREAM_HPP_
+
+#include "op_functions.hpp"
+#include <atomic>
+#include <memory>
+
+namespace be {
+namespace op {
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  An atomic index which does not share a cache line with anything
+///         else.
+///
+/// \details Uses padding rather than alignas, since operator new and
+///         std::allocator (e.g. std::make_shared) do not honor extended
+///         alignment before C++17.
+struct PaddedIndex {
+   explicit PaddedIndex(std::size_t value) : value(value) { }
+
+   char before[64];
+   std::atomic<std::size_t> value;
+   char after[64 - sizeof(std::atomic<std::size_t>)];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Bounded lock-free multi-producer, single-consumer ring buffer.
+///
+/// \details Values are moved into and out of preallocated slots, so pushing
+///         and popping never allocate (unless T's move assignment does).
+///         Capacity is rounded up to a power of two.
+template <typename T>
+class MpscRing final {
+public:
+   explicit MpscRing(std::size_t capacity)
+      : head_(0),
+        tail_(0)
+   {
+      std::size_t size = 2;
+      while (size < capacity) {
+         size <<= 1;
+      }
+      mask_ = size - 1;
+      slots_.reset(new slot[size]);
+      for (std::size_t i = 0; i < size; ++i) {
+         slots_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+   }
+
+   MpscRing(const MpscRing&) = delete;
+   MpscRing& operator=(const MpscRing&) = delete;
+
+   /// Can be called from any thread.  value is only moved-from if the push
+   /// succeeds.  Returns false if the ring is full.
+   bool try_push(T&& value) {
+      std::size_t pos = head_.value.load(std::memory_order_relaxed);
+      for (;;) {
+         slot& s = slots_[pos & mask_];
+         std::size_t seq = s.sequence.load(std::memory_order_acquire);
+         std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+         if (diff == 0) {
+            if (head_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+               s.value = std::move(value);
+               s.sequence.store(pos + 1, std::memory_order_release);
+               return true;
+            }
+         } else if (diff < 0) {
+            return false;
+         } else {
+            pos = head_.value.load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   /// Must only be called from the consumer thread.  Returns false if the
+   /// ring is empty.
+   bool try_pop(T& value) {
+      std::size_t tail = tail_.value.load(std::memory_order_relaxed);
+      slot& s = slots_[tail & mask_];
+      std::size_t seq = s.sequence.load(std::memory_order_acquire);
+      if ((std::ptrdiff_t)seq - (std::ptrdiff_t)(tail + 1) < 0) {
+         return false;
+      }
+      value = std::move(s.value);
+      s.value = T();
+      s.sequence.store(tail + mask_ + 1, std::memory_order_release);
+      tail_.value.store(tail + 1, std::memory_order_release);
+      return true;
+   }
+
+   /// Can be called from any thread, but is approximate when called
+   /// concurrently with try_push() or try_pop().
+   std::size_t size() const {
+      std::size_t tail = tail_.value.load(std::memory_order_relaxed);
+      std::size_t head = head_.value.load(std::memory_order_relaxed);
+      return head > tail ? head - tail : 0;
+   }
+
+   std::size_t capacity() const {
+      return mask_ + 1;
+   }
+
+private:
+   struct slot {
+      std::atomic<std::size_t> sequence;
+      T value;
+   };
+
+   std::unique_ptr<slot[]> slots_;
+   std::size_t mask_;
+   PaddedIndex head_;
+   // only written by the consumer, but read by size() on any thread
+   PaddedIndex tail_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Bounded lock-free single-producer, single-consumer ring buffer.
+///
+/// \details Cheaper than MpscRing when each ring only ever has one producer,
+///         since pushing needs no compare-and-swap.  Capacity is rounded up
+///         to a power of two.
+template <typename T>
+class SpscRing final {
+public:
+   explicit SpscRing(std::size_t capacity)
+      : head_(0),
+        tail_(0)
+   {
+      std::size_t size = 2;
+      while (size < capacity) {
+         size <<= 1;
+      }
+      mask_ = size - 1;
+      slots_.reset(new T[size]);
+   }
+
+   SpscRing(const SpscRing&) = delete;
+   SpscRing& operator=(const SpscRing&) = delete;
+
+   /// Must only be called from the producer thread.  value is only
+   /// moved-from if the push succeeds.  Returns false if the ring is full.
+   bool try_push(T&& value) {
+      std::size_t head = head_.value.load(std::memory_order_relaxed);
+      if (head - tail_.value.load(std::memory_order_acquire) > mask_) {
+         return false;
+      }
+      slots_[head & mask_] = std::move(value);
+      head_.value.store(head + 1, std::memory_order_release);
+      return true;
+   }
+
+   /// Must only be called from the consumer thread.  Returns false if the
+   /// ring is empty.
+   bool try_pop(T& value) {
+      std::size_t tail = tail_.value.load(std::memory_order_relaxed);
+      if (tail == head_.value.load(std::memory_order_acquire)) {
+         return false;
+      }
+      value = std::move(slots_[tail & mask_]);
+      slots_[tail & mask_] = T();
+      tail_.value.store(tail + 1, std::memory_order_release);
+      return true;
+   }
+
+   /// Approximate when called concurrently with try_push() or try_pop().
+   std::size_t size() const {
+      return head_.value.load(std::memory_order_relaxed) - tail_.value.load(std::memory_order_relaxed);
+   }
+
+   std::size_t capacity() const {
+      return mask_ + 1;
+   }
+
+private:
+   std::unique_ptr<T[]> slots_;
+   std::size_t mask_;
+   PaddedIndex head_;
+   PaddedIndex tail_;
+};
+
+struct StreamQueue;
+
+///////////////////////////////////////////////////////////////////////////////
+struct StreamState {
+   explicit StreamState(std::size_t capacity) : ring(capacity) { }
+
+   MpscRing<Op> ring;
+   std::atomic<bool> closed { false };
+   std::atomic<U64> rejected { 0 };
+   std::atomic<const StreamQueue*> consumer { nullptr };
+   Op current;
+   bool active = false;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct StreamQueue : OpFunc<StreamQueue>, HeapStored {
+   StreamQueue(std::shared_ptr<StreamState> state) : state(std::move(state)) { }
+   StreamQueue(const StreamQueue& other) = default;
+   StreamQueue(StreamQueue&& other);
+   StreamQueue& operator=(const StreamQueue& other);
+   StreamQueue& operator=(StreamQueue&& other);
+   ~StreamQueue();
+   void operator()(OpData& data, F64& dt);
+   std::shared_ptr<StreamState> state;
+
+private:
+   void release_();
+};
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+class Stream final {
+public:
+   explicit Stream(std::size_t capacity = 256);
+
+   bool push(Op&& op);
+   bool push(OpData::action_func func, F64 remaining = -1, F64 total = 0);
+
+   void close();
+   bool closed() const;
+
+   U64 rejected() const;
+   std::size_t size() const;
+   std::size_t capacity() const;
+
+   detail::StreamQueue action() const;
+
+private:
+   std::shared_ptr<detail::StreamState> state_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -3,7 +3,12 @@
 #define BE_CORE_OPUS_HPP_
 
 #include "op.hpp"
+#include "op_buffered_state.hpp"
 #include "op_containers.hpp"
+#include "op_prefab.hpp"
+#include "op_signal.hpp"
+#include "opus_metrics.hpp"
+#include <mutex>
 #include <unordered_map>
 
 namespace be {
@@ -15,6 +20,47 @@ inline Op default_op_generator(Id) {
    return op;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+struct MemoryUsage {
+   std::size_t used = 0;
+   std::size_t unused = 0;
+
+   MemoryUsage& operator+=(const MemoryUsage& other) {
+      used += other.used;
+      unused += other.unused;
+      return *this;
+   }
+};
+
+class OpusRecorder;
+
+///////////////////////////////////////////////////////////////////////////////
+class OpSubtree final : Movable {
+   friend class Opus;
+public:
+   OpSubtree();
+
+   Id id() const;
+   std::size_t size() const;
+   bool empty() const;
+
+private:
+   struct node {
+      Id id;
+      Id parent;
+      I32 priority;
+      U32 divisor;
+      F64 frequency;
+      Id domain;
+      Handle<Op> op;
+      Id signal;
+      Id watch;
+   };
+
+   std::vector<node> nodes_;
+   Op op_;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 class Opus final : Movable {
    using child_id_list = std::vector<Id>;
@@ -24,15 +70,54 @@ class Opus final : Movable {
       child_id_list children;
       bool children_dirty = false;
       I32 priority = 0;
+      U32 divisor = 1;
+      F64 frequency = 0;
+      bool staggered = false;
+      Id domain;
+      Id signal;
+      Id watch;
+      bool paused = false;
    };
    using opus_map = std::unordered_map<Id, op_meta>;
+   using prefab_map = std::unordered_map<Id, Prefab>;
+   using domain_map = std::unordered_map<Id, std::shared_ptr<TimeDomain>>;
+   using signal_map = std::unordered_map<Id, std::shared_ptr<Signal>>;
+   using paused_map = std::unordered_map<Id, Signal::waiter_list>;
+   struct pending_wait {
+      Id id;
+      Id signal;
+      U64 fires;
+   };
+   using wait_list = std::vector<pending_wait>;
+   struct published_op {
+      Handle<Op> op;
+      F64 remaining;
+      F64 total;
+   };
+   using published_map = std::unordered_map<Id, published_op>;
+   using buffered_state_map = std::unordered_map<Id, std::unique_ptr<detail::BufferedStateBase>>;
+   struct tree_index {
+      std::atomic<bool> valid { false };
+      std::mutex mutex;
+      std::vector<Id> ids;
+      std::vector<U32> depths;
+      std::vector<U32> ends;
+      std::unordered_map<Id, U32> positions;
+   };
+   using scheduled_func = detail::Scheduled<OpData::action_func>;
+   using domain_func = detail::DomainBound<OpData::action_func>;
    using op_generator = std::function<Op(Id)>;
+   struct action_slot {
+      OpData::action_func* action;
+      const ActionTraits** traits;
+   };
 public:
    using iterator = child_id_list::const_iterator;
 
    Opus(op_generator op_gen = default_op_generator);
 
    F64 operator()(F64 dt);
+   F64 fast_forward(F64 dt, F64 step_size);
 
    Op& root();
    Op& operator[](Id id);
@@ -43,6 +128,9 @@ public:
    iterator begin(Id id) const;
    iterator end(Id id) const;
 
+   iterator descendants_begin(Id id) const;
+   iterator descendants_end(Id id) const;
+
    Op& child(Id parent_id, Id child_id, I32 priority);
 
    Op& before(Id sibling_id, Id op_id, I32 priority_delta);
@@ -51,26 +139,142 @@ public:
    Id parent(Id child_id) const;
    Id parent(Id child_id, Id new_parent_id);
 
+   bool is_ancestor(Id ancestor_id, Id id) const;
+   U32 depth(Id id) const;
+   Id common_ancestor(Id a, Id b) const;
+
    I32 priority(Id id) const;
    I32 priority(Id id, I32 new_priority);
 
+   U32 divisor(Id id) const;
+   U32 divisor(Id id, U32 new_divisor);
+
+   F64 frequency(Id id) const;
+   F64 frequency(Id id, F64 new_frequency);
+
+   F64 cost(Id id) const;
+   F64 cost(Id id, F64 new_cost);
+   bool cost_overridden(Id id) const;
+
+   TimeDomain& time_domain(Id domain_id);
+
+   Id domain(Id id) const;
+   Id domain(Id id, Id new_domain_id);
+
+   Signal& signal(Id signal_id);
+   void wait(Id id, Id signal_id);
+   void wait_for(Id id, Id signal_id);
+
+   bool published(Id id) const;
+   bool published(Id id, bool publish);
+   F64 published_remaining(Id id) const;
+   F64 published_total(Id id) const;
+
+   template <typename T>
+   BufferedState<T>& buffered_state(Id state_id, T initial = T(), bool carry_forward = true);
+
    bool exists(Id id) const;
 
    void erase(Id id);
+
+   const Prefab* prefab(Id prefab_id) const;
+   void prefab(Id prefab_id, Prefab prefab);
+   Prefab capture(Id id) const;
+   Op& instantiate(Id prefab_id, Id parent_id, Id instance_id, I32 priority);
+
+   OpSubtree extract(Id id);
+   Op& adopt(OpSubtree subtree, Id parent_id);
+
+   OpusRecorder* recorder() const;
+   OpusRecorder* recorder(OpusRecorder* new_recorder);
+
+   OpusMetrics& metrics();
+   const OpusMetrics& metrics() const;
+
+   MemoryUsage memory() const;
+   MemoryUsage memory(Id id) const;
+   MemoryUsage subtree_memory(Id id) const;
+   void shrink_to_fit();
    
 private:
    op_meta& get_or_create_(Id id);
    op_meta& get_or_create_with_op_(Id id);
 
+   void erase_(Id id);
+
    void clean_();
    void clean_(op_meta& meta);
 
+   void resolve_domains_(F64 dt);
+   Id enclosing_domain_(Id id) const;
+   bool bound_below_(Id id) const;
+   void unnest_domains_(Id id);
+   void pause_(Id id, op_meta& meta);
+   void resume_(Id domain_id);
+   bool tracks_positions_(Op& op);
+   action_slot unbound_action_(Op& op);
+   action_slot inner_action_(Op& op);
+   scheduled_func* schedule_(op_meta& meta);
+   void stagger_(op_meta& meta);
+
+   const tree_index& tree_index_() const;
+   void publish_();
+
+   void extract_(OpSubtree& subtree, op_meta& meta, Id id);
+   void unpark_(op_meta& meta);
+   void release_children_(Id id) const;
+
+   Signal::waiter_list* parked_list_(const op_meta& meta);
+   void park_(Id id, Id signal_id);
+   void watch_(op_meta& meta, Id id, Id signal_id);
+   void unwatch_(op_meta& meta, Id id);
+   void wake_();
+
+   void capture_(Prefab& prefab, const op_meta& meta, Id relative_id) const;
+   Op build_(const Prefab& prefab, std::size_t index);
+   void register_(const Prefab& prefab, std::size_t index, Op& op, Id instance_id, Id parent_id, I32 priority);
+
+   MemoryUsage memory_(const op_meta& meta) const;
+   MemoryUsage subtree_memory_(const op_meta& meta) const;
+
    Op root_;
    opus_map meta_;
+   prefab_map prefabs_;
+   domain_map domains_;
+   signal_map signals_;
+   paused_map paused_;
+   std::shared_ptr<std::atomic<Signal*>> fired_;
+   wait_list pending_waits_;
+   published_map published_;
+   buffered_state_map buffered_states_;
+   std::unique_ptr<tree_index> index_;
    bool dirty_;
+   OpusRecorder* recorder_;
+   std::unique_ptr<OpusMetrics> metrics_;
+   U64 mutations_;
+   U64 clean_lists_;
+   U64 clean_children_;
    op_generator op_gen_;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Retrieves the buffered state block with the specified Id,
+///         creating it from initial and carry_forward if it does not exist.
+///
+/// \details Every block is published at the end of each tick; see
+///         op::BufferedState.  The returned reference remains valid for the
+///         lifetime of the Opus.  Each Id must always be used with the same
+///         T.
+template <typename T>
+BufferedState<T>& Opus::buffered_state(Id state_id, T initial, bool carry_forward) {
+   auto& ptr = buffered_states_[state_id];
+   if (!ptr) {
+      ptr.reset(new BufferedState<T>(std::move(initial), carry_forward));
+   }
+   assert(dynamic_cast<BufferedState<T>*>(ptr.get()));
+   return static_cast<BufferedState<T>&>(*ptr);
+}
+
 // TODO printtraits?
 
 } // be::op
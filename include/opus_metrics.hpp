@@ -0,0 +1,103 @@
+#pragma once
+#ifndef BE_CORE_OPUS_METRICS_HPP_
+#define BE_CORE_OPUS_METRICS_HPP_
+
+#include "op.hpp"
+#include <array>
+#include <atomic>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Bucket i counts values v where 2^(i-1) <= v < 2^i; bucket 0
+///         counts zeros, and the last bucket also counts anything larger.
+using MetricHistogram = std::array<U64, 40>;
+
+///////////////////////////////////////////////////////////////////////////////
+struct OpusMetricsSnapshot {
+   U64 ticks = 0;
+   U64 tick_ns_total = 0;
+   U64 tick_ns_max = 0;
+   MetricHistogram tick_ns = { };
+   U64 jitter_ns_max = 0;
+   MetricHistogram jitter_ns = { };
+
+   U64 ops_invoked = 0;
+   MetricHistogram ops_per_tick = { };
+
+   U64 cleans = 0;
+   U64 parents_sorted = 0;
+   U64 children_sorted = 0;
+   U64 clean_ns_total = 0;
+   U64 clean_ns_max = 0;
+
+   U64 mutations = 0;
+   MetricHistogram mutations_per_tick = { };
+
+   U64 ops_created = 0;
+   U64 ops_destroyed = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Scheduler telemetry for an op::Opus.
+///
+/// \details Values are only written by the thread running the Opus, using
+///         relaxed atomics, and can be read from any thread without locks.
+///         A snapshot is not taken atomically as a whole, so values from the
+///         tick in progress may be partially included.
+///
+///         Each fast_forward() counts as one tick.  Ops moved out of the Opus
+///         by extract() count as destroyed, and ops moved in by adopt() count
+///         as created.
+class OpusMetrics final {
+public:
+   OpusMetrics();
+
+   OpusMetrics(const OpusMetrics&) = delete;
+   OpusMetrics& operator=(const OpusMetrics&) = delete;
+
+   OpusMetricsSnapshot snapshot() const;
+   OpusMetricsSnapshot take();
+
+   void record_tick(U64 ns, U64 ops_invoked, U64 mutations);
+   void record_clean(U64 ns, U64 parents_sorted, U64 children_sorted);
+   void record_created(U64 ops);
+   void record_destroyed(U64 ops);
+
+private:
+   using histogram = std::array<std::atomic<U64>, std::tuple_size<MetricHistogram>::value>;
+
+   template <typename M, typename Read>
+   static void read_(M& m, OpusMetricsSnapshot& s, Read read);
+
+   std::atomic<U64> ticks_;
+   std::atomic<U64> tick_ns_total_;
+   std::atomic<U64> tick_ns_max_;
+   histogram tick_ns_;
+   std::atomic<U64> jitter_ns_max_;
+   histogram jitter_ns_;
+
+   std::atomic<U64> ops_invoked_;
+   histogram ops_per_tick_;
+
+   std::atomic<U64> cleans_;
+   std::atomic<U64> parents_sorted_;
+   std::atomic<U64> children_sorted_;
+   std::atomic<U64> clean_ns_total_;
+   std::atomic<U64> clean_ns_max_;
+
+   std::atomic<U64> mutations_;
+   histogram mutations_per_tick_;
+
+   std::atomic<U64> ops_created_;
+   std::atomic<U64> ops_destroyed_;
+
+   // only touched by the writer
+   U64 last_tick_ns_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#ifndef BE_CORE_OPUS_RECORDER_HPP_
+#define BE_CORE_OPUS_RECORDER_HPP_
+
+#include "op.hpp"
+#include <iosfwd>
+
+namespace be {
+namespace op {
+
+class Opus;
+
+///////////////////////////////////////////////////////////////////////////////
+enum class OpusLogEventType : U8 {
+   tick = 1,
+   fast_forward,
+   create,
+   child,
+   erase,
+   parent,
+   priority
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct OpusLogEvent {
+   OpusLogEventType type = OpusLogEventType::tick;
+   Id id;
+   Id other_id;
+   I32 priority = 0;
+   F64 dt = 0;
+   F64 step_size = 0;
+
+   void apply(Opus& opus) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Writes the structural mutations and dt values applied to an Opus
+///         to a compact binary log.
+///
+/// \details Attach a recorder with Opus::recorder(OpusRecorder*).  Each
+///         event is a one byte type followed by fixed-width fields in host
+///         byte order; the log starts with a short header identifying the
+///         format version.  Only calls made through the Opus's public
+///         interface are recorded, so the same calls can be made again by
+///         OpusLogReader.
+class OpusRecorder final {
+public:
+   explicit OpusRecorder(std::ostream& os);
+
+   OpusRecorder(const OpusRecorder&) = delete;
+   OpusRecorder& operator=(const OpusRecorder&) = delete;
+
+   void record(const OpusLogEvent& event);
+
+   U64 events() const;
+
+private:
+   std::ostream* os_;
+   U64 events_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+class OpusLogReader final {
+public:
+   explicit OpusLogReader(std::istream& is);
+
+   OpusLogReader(const OpusLogReader&) = delete;
+   OpusLogReader& operator=(const OpusLogReader&) = delete;
+
+   bool valid() const;
+   bool next(OpusLogEvent& event);
+
+private:
+   std::istream* is_;
+   bool valid_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef BE_CORE_OPUS_SHARDS_HPP_
+#define BE_CORE_OPUS_SHARDS_HPP_
+
+#include "opus.hpp"
+#include "op_stream.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+class OpusShards final {
+public:
+   using message = std::function<void(Opus&)>;
+   using op_generator = std::function<Op(Id)>;
+
+   static constexpr std::size_t no_shard = ~std::size_t(0);
+
+   explicit OpusShards(std::size_t shards = default_size(), std::size_t mailbox_capacity = 1024, op_generator op_gen = default_op_generator);
+   ~OpusShards();
+
+   OpusShards(const OpusShards&) = delete;
+   OpusShards& operator=(const OpusShards&) = delete;
+
+   std::size_t size() const;
+   Opus& operator[](std::size_t shard);
+   std::thread::native_handle_type native_handle(std::size_t shard);
+
+   F64 operator()(F64 dt);
+
+   bool send(std::size_t from, std::size_t to, message msg);
+   void migrate(std::size_t from, std::size_t to, Id id, Id parent_id = Id());
+
+   static std::size_t current();
+   static std::size_t default_size();
+
+private:
+   using mailbox = detail::SpscRing<message>;
+
+   struct migration {
+      std::size_t to;
+      Id id;
+      Id parent_id;
+   };
+
+   struct shard {
+      explicit shard(op_generator op_gen) : opus(std::move(op_gen)) { }
+
+      Opus opus;
+      std::vector<migration> migrations;
+      std::thread thread;
+   };
+
+   mailbox& mailbox_(std::size_t from, std::size_t to);
+   std::size_t mailbox_index_(std::size_t from, std::size_t to) const;
+   void run_(std::size_t index);
+   void tick_(std::size_t index, F64 dt);
+
+   std::vector<std::unique_ptr<shard>> shards_;
+   std::vector<std::unique_ptr<mailbox>> mailboxes_;
+   std::vector<std::size_t> deliveries_;
+   std::mutex mutex_;
+   std::condition_variable start_cv_;
+   std::condition_variable done_cv_;
+   U64 generation_;
+   std::size_t running_;
+   F64 dt_;
+   bool stopping_;
+};
+
+} // be::op
+} // be
+
+#endif
@@ -30,8 +30,20 @@ const OpData::action_func& Op::action() const {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
+/// \brief  Sets the op's action.
+///
+/// \details Since func's concrete type is unknown, the op's traits are
+///         cleared, and fast-forwarding will fall back to stepping the
+///         action.  Prefer the templated overload when the type is known.
 void Op::action(OpData::action_func func) {
    data_.action = std::move(func);
+   data_.traits = nullptr;
+   ++data_.revision;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const ActionTraits* Op::traits() const {
+   return data_.traits;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -43,6 +55,7 @@ F64 Op::remaining() const {
 F64 Op::remaining(F64 new_value) {
    F64 val = data_.remaining;
    data_.remaining = new_value;
+   ++data_.revision;
    return val;
 }
 
@@ -55,14 +68,39 @@ F64 Op::total() const {
 F64 Op::total(F64 new_value) {
    F64 val = data_.total;
    data_.total = new_value;
+   ++data_.revision;
    return val;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the estimated number of seconds it takes to run the op
+///         (including its descendants).
+///
+/// \details The estimate is an exponentially weighted average measured by
+///         op::detail::Measured or a parent op::detail::ParallelSet, unless
+///         it has been overridden with op::Opus::cost(Id, F64).  Ops which
+///         have never been measured return 0.
+F64 Op::cost() const {
+   return std::abs(data_.cost);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 void Op::operator()(F64 dt) {
+   ++detail::invocation_count();
    data_.action(data_, dt);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Advances the op by dt as quickly as possible.
+///
+/// \details If the op's action provides an advance() hook, it is called once
+///         with the whole dt.  Otherwise, the action is called repeatedly
+///         with dt values no larger than step_size.  On return, dt holds any
+///         time that the op did not consume.
+void Op::advance(F64& dt, F64 step_size) {
+   detail::advance(data_.action, data_.traits, data_, dt, step_size);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 void Op::swap_(Op& other) {
    using std::swap;
@@ -70,5 +108,75 @@ void Op::swap_(Op& other) {
    swap_source_handle_(other);
 }
 
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Advances an action by dt by calling it repeatedly with a fixed
+///         step size.
+///
+/// \details Stepping stops early if the op completes.  Any part of the final
+///         step that the action did not consume is added back to dt.
+///
+/// \return The number of times the action was called.
+U64 step(OpData::action_func& func, OpData& data, F64& dt, F64 step_size) {
+   U64 calls = 0;
+   while (dt > 0) {
+      F64 s = step_size > 0 && step_size < dt ? step_size : dt;
+      F64 mdt = s;
+      ++invocation_count();
+      ++calls;
+      func(data, mdt);
+      dt -= s;
+      if (data.remaining == 0) {
+         dt += mdt;
+         break;
+      }
+   }
+   return calls;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Advances an action using its advance() hook if it has one, or by
+///         stepping it otherwise.
+///
+/// \return The number of times the action itself was invoked (1 for a
+///         hook), not counting any children it ran.
+U64 advance(OpData::action_func& func, const ActionTraits* traits, OpData& data, F64& dt, F64 step_size) {
+   if (traits && traits->advance) {
+      ++invocation_count();
+      traits->advance(func, data, dt, step_size);
+      return 1;
+   }
+   return step(func, data, dt, step_size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Asks an action to return any state it holds on behalf of its
+///         op's children (see op::detail::TypedSet) to those children.
+///
+/// \details The Opus calls this on an op before moving one of its children
+///         elsewhere, or replacing one of its children's actions.
+void release_children(OpData::action_func& func, const ActionTraits* traits, OpData& data) {
+   if (traits && traits->release_children) {
+      traits->release_children(func, data);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the number of heap bytes owned by an action, not counting
+///         the boost::function object itself.
+///
+/// \details Includes the action object, if it is too large for
+///         boost::function's small object buffer, and anything the action
+///         reports through a heap_size() member.  Actions without traits
+///         (see Op::action(OpData::action_func)) are reported as 0.
+std::size_t heap_size(const OpData::action_func& func, const ActionTraits* traits) {
+   if (traits && traits->heap_size) {
+      return traits->heap_size(func);
+   }
+   return 0;
+}
+
+} // be::op::detail
 } // be::op
 } // be
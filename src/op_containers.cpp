@@ -1,5 +1,6 @@
 #include "pch.hpp"
 #include "op_containers.hpp"
+#include <chrono>
 
 namespace be {
 namespace op {
@@ -19,7 +20,10 @@ namespace detail {
 ///         to 0.
 ///
 ///         When called for the first time or when called with a dt of 0, the
-///         internal pointer will be reset to the first child of the op.
+///         internal position will be reset to the first child of the op.  The
+///         position is an index, so it stays valid if the child list is
+///         reallocated, but removing or re-sorting children before it will
+///         shift which child it refers to.
 ///
 ///         If additional children are added to the end of an existing queue,
 ///         or if the final child's remaining() time is increased after the
@@ -29,18 +33,25 @@ namespace detail {
 ///         updated until it is called at least once and discovers that there
 ///         is more work.
 void Queue::operator()(OpData& data, F64& dt) {
+   auto& children = data.children;
    if (!initialized || dt == 0) {
-      position = data.children.begin();
-      if (position == data.children.end()) {
-         initialized = false;
+      position = 0;
+      initialized = !children.empty();
+      if (!initialized) {
          return;
-      } else {
-         initialized = true;
       }
    }
 
+   if (position >= children.size()) {
+      // children were removed since the last call
+      if (children.empty()) {
+         return;
+      }
+      position = children.size() - 1;
+   }
+
    while (dt > 0) {
-      Op& op = *position;
+      Op& op = children[position];
       if (op.remaining()) {
          data.remaining = -1;
          op(dt);
@@ -48,9 +59,49 @@ void Queue::operator()(OpData& data, F64& dt) {
             return;
          }
       }
-      auto it = position + 1;
-      if (it != data.children.end()) {
-         position = it;
+      if (position + 1 < children.size()) {
+         ++position;
+      } else {
+         data.remaining = 0;
+         return;
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards the queue by dt.
+///
+/// \details Works like operator(), but each child is advanced (see
+///         Op::advance()) rather than called, so children which provide an
+///         advance() hook can skip over long spans of time in a single call.
+void Queue::advance(OpData& data, F64& dt, F64 step_size) {
+   auto& children = data.children;
+   if (!initialized) {
+      position = 0;
+      initialized = !children.empty();
+      if (!initialized) {
+         return;
+      }
+   }
+
+   if (position >= children.size()) {
+      if (children.empty()) {
+         return;
+      }
+      position = children.size() - 1;
+   }
+
+   while (dt > 0) {
+      Op& op = children[position];
+      if (op.remaining()) {
+         data.remaining = -1;
+         op.advance(dt, step_size);
+         if (op.remaining()) {
+            return;
+         }
+      }
+      if (position + 1 < children.size()) {
+         ++position;
       } else {
          data.remaining = 0;
          return;
@@ -70,7 +121,10 @@ void Queue::operator()(OpData& data, F64& dt) {
 ///         to 0.
 ///
 ///         When called for the first time or when called with a dt of 0, the
-///         internal pointer will be reset to the first child of the op.
+///         internal position will be reset to the first child of the op.  The
+///         position is an index, so it stays valid if the child list is
+///         reallocated, but removing or re-sorting children before it will
+///         shift which child it refers to.
 ///
 ///         If additional children are added to the end of an existing queue,
 ///         or if the final child's remaining() time is increased after the
@@ -91,6 +145,22 @@ void Set::operator()(OpData& data, F64& dt) {
    data.remaining = finished ? 0 : -1;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards each unfinished child by dt.
+void Set::advance(OpData& data, F64& dt, F64 step_size) {
+   bool finished = true;
+   for (Op& op : data.children) {
+      if (op.remaining() != 0) {
+         F64 mdt = dt;
+         op.advance(mdt, step_size);
+         if (op.remaining() != 0) {
+            finished = false;
+         }
+      }
+   }
+   data.remaining = finished ? 0 : -1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief  Works like op::detail::Set, but always executes all children,
 ///         regardless of whether or not they have finished their work.
@@ -107,6 +177,188 @@ void StaticSet::operator()(OpData& data, F64& dt) {
    }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards every child by dt.
+void StaticSet::advance(OpData& data, F64& dt, F64 step_size) {
+   for (Op& op : data.children) {
+      F64 mdt = dt;
+      op.advance(mdt, step_size);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+RoundRobin::RoundRobin(std::size_t per_tick, F64 budget)
+   : per_tick(per_tick),
+     budget(budget)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Copies (e.g. prefab instances) start with an empty table of owed
+///         dt, since the table refers to the original's children.
+RoundRobin::RoundRobin(const RoundRobin& other)
+   : per_tick(other.per_tick),
+     budget(other.budget)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+RoundRobin& RoundRobin::operator=(const RoundRobin& other) {
+   per_tick = other.per_tick;
+   budget = other.budget;
+   position = 0;
+   elapsed = 0;
+   revision = 0;
+   ops.clear();
+   visited.clear();
+   return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Executes a limited number of its children each time it is run,
+///         continuing where it left off the next time.
+///
+/// \details Each time the op is run, up to per_tick children will be
+///         executed, starting after the last child that was executed
+///         previously and wrapping around to the first child after the last.
+///         If per_tick is 0, there is no limit on the number of children.
+///
+///         If budget is greater than 0, the op will also stop once budget
+///         seconds of real time have been spent executing children.  At least
+///         one child is always executed, so that the op always makes
+///         progress.  No child will be executed more than once per call.
+///
+///         Each child is passed the total dt that the round robin has
+///         received since that child was last executed.  Children that have
+///         just been added are passed only the dt received after they were
+///         noticed.  The dt owed to each child (and the position) follows
+///         the child when the child list is re-sorted or other children are
+///         added or removed; see sync().
+///
+///         When called with a dt of 0, every child is called with a dt of 0
+///         and the internal position is reset to the first child.
+///
+///         Like op::detail::StaticSet, RoundRobin doesn't check
+///         child.remaining() before calling children, and never sets its own
+///         remaining() value.
+void RoundRobin::operator()(OpData& data, F64& dt) {
+   auto& children = data.children;
+   std::size_t n = children.size();
+   sync(data);
+
+   if (dt == 0) {
+      position = 0;
+      for (Op& op : children) {
+         F64 mdt = 0;
+         op(mdt);
+      }
+      return;
+   }
+
+   elapsed += dt;
+
+   if (n == 0) {
+      return;
+   }
+
+   if (position >= n) {
+      position = 0;
+   }
+
+   std::size_t limit = per_tick > 0 && per_tick < n ? per_tick : n;
+
+   using clock = std::chrono::steady_clock;
+   clock::time_point start;
+   if (budget > 0) {
+      start = clock::now();
+   }
+
+   for (std::size_t i = 0; i < limit; ++i) {
+      F64 mdt = elapsed - visited[position];
+      visited[position] = elapsed;
+      children[position](mdt);
+
+      if (++position == n) {
+         position = 0;
+      }
+
+      if (budget > 0 && std::chrono::duration<F64>(clock::now() - start).count() >= budget) {
+         break;
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards every child by dt, plus any dt it was already owed.
+///
+/// \details The time budget and per_tick limit are ignored; after advancing,
+///         no child is owed any dt and the position is unchanged.
+void RoundRobin::advance(OpData& data, F64& dt, F64 step_size) {
+   auto& children = data.children;
+   std::size_t n = children.size();
+   sync(data);
+
+   elapsed += dt;
+
+   for (std::size_t i = 0; i < n; ++i) {
+      F64 mdt = elapsed - visited[i];
+      visited[i] = elapsed;
+      children[i].advance(mdt, step_size);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t RoundRobin::heap_size() const {
+   return ops.capacity() * sizeof(Handle<Op>) + visited.capacity() * sizeof(F64);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Rebuilds the table of owed dt when the child list has changed.
+///
+/// \details The table is keyed by Handles to the children, which follow
+///         each op as it is moved within the list, so that the dt owed to a
+///         child (and the child at the current position) is still found
+///         after children are re-sorted, added, or removed.  The table is
+///         only rebuilt when the op's revision or number of children
+///         changes.
+void RoundRobin::sync(OpData& data) {
+   auto& children = data.children;
+   std::size_t n = children.size();
+
+   if (revision == data.revision && ops.size() == n) {
+      return;
+   }
+
+   Op* base = n > 0 ? &children[0] : nullptr;
+   auto index_of = [=](const Handle<Op>& handle) -> std::size_t {
+      Op* op = handle.get();
+      if (op && op >= base && op < base + n) {
+         return (std::size_t)(op - base);
+      }
+      return n;
+   };
+
+   std::vector<F64> owed(n, elapsed);
+   for (std::size_t i = 0; i < ops.size(); ++i) {
+      std::size_t index = index_of(ops[i]);
+      if (index < n) {
+         owed[index] = visited[i];
+      }
+   }
+
+   if (position < ops.size()) {
+      std::size_t index = index_of(ops[position]);
+      position = index < n ? index : position;
+   }
+
+   ops.clear();
+   ops.reserve(n);
+   for (Op& op : children) {
+      ops.push_back(static_cast<Handle<Op>>(op));
+   }
+
+   visited = std::move(owed);
+   revision = data.revision;
+}
+
 } // be::op::detail
 } // be::op
 } // be
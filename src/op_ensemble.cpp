@@ -0,0 +1,57 @@
+#include "pch.hpp"
+#include "op_ensemble.hpp"
+#include <algorithm>
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Creates an ensemble of identically structured instances.
+///
+/// \details A single Opus holds the structure shared by every instance: Ids,
+///         priorities, and child ordering, which clean_() only needs to
+///         maintain once.  Per-instance state lives in the EnsembleBlock of
+///         each op created with child().
+Ensemble::Ensemble(std::size_t instances, std::function<Op(Id)> op_gen)
+   : instances_(instances),
+     opus_(std::move(op_gen)),
+     prune_at_(64)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t Ensemble::instances() const {
+   return instances_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Opus& Ensemble::opus() {
+   return opus_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Runs one tick of every instance.
+F64 Ensemble::operator()(F64 dt) {
+   return opus_(dt);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Forgets the blocks of ops which have been erased.
+///
+/// \details Blocks are only owned by their ops' actions, so an erased op's
+///         entry expires but would otherwise stay in the map until its Id is
+///         looked up.  child() calls this whenever the map has doubled in size
+///         since the last pass, so the map stays proportional to the number
+///         of live blocks at an amortized constant cost per child().
+void Ensemble::prune_() {
+   for (auto it = blocks_.begin(); it != blocks_.end(); ) {
+      if (it->second.expired()) {
+         it = blocks_.erase(it);
+      } else {
+         ++it;
+      }
+   }
+   prune_at_ = std::max<std::size_t>(64, blocks_.size() * 2);
+}
+
+} // be::op
+} // be
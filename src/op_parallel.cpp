@@ -0,0 +1,443 @@
+#include "pch.hpp"
+#include "op_parallel.hpp"
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Starts a pool of worker threads which execute posted tasks in
+///         FIFO order.
+///
+/// \details A pool with 0 threads is valid; tasks posted to it will only run
+///         when another thread calls run_one().
+WorkerPool::WorkerPool(std::size_t threads)
+   : stopping_(false)
+{
+   threads_.reserve(threads);
+   for (std::size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back([this]() { run_(); });
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Finishes any tasks which have already been posted, then stops all
+///         worker threads.
+WorkerPool::~WorkerPool() {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+   }
+   cv_.notify_all();
+   for (std::thread& t : threads_) {
+      t.join();
+   }
+   task t;
+   while (pop_(t)) {
+      t();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t WorkerPool::size() const {
+   return threads_.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void WorkerPool::post(task t) {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(t));
+   }
+   cv_.notify_one();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Runs the oldest queued task on the calling thread, if there is
+///         one.
+///
+/// \return false if there were no tasks waiting.
+bool WorkerPool::run_one() {
+   task t;
+   if (pop_(t)) {
+      t();
+      return true;
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns one less than the number of hardware threads, so that the
+///         thread which owns the pool has a core to itself.
+std::size_t WorkerPool::default_size() {
+   std::size_t n = std::thread::hardware_concurrency();
+   return n > 1 ? n - 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool WorkerPool::pop_(task& t) {
+   std::lock_guard<std::mutex> lock(mutex_);
+   if (tasks_.empty()) {
+      return false;
+   }
+   t = std::move(tasks_.front());
+   tasks_.pop_front();
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void WorkerPool::run_() {
+   for (;;) {
+      task t;
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+         if (tasks_.empty()) {
+            return;
+         }
+         t = std::move(tasks_.front());
+         tasks_.pop_front();
+      }
+      t();
+   }
+}
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Claims the next chunk of the range, up to limit.
+///
+/// \details Chunk sizes are adaptive: each claim takes a fraction of the work
+///         remaining, divided among all participating threads, but never less
+///         than grain elements.  Early chunks are large to minimize
+///         contention, and later chunks shrink so that threads finish at
+///         about the same time.
+bool ParallelForState::grab(std::size_t limit, std::size_t& chunk_begin, std::size_t& chunk_end) {
+   const std::size_t participants = 2 * (pool->size() + 1);
+   std::size_t cur = next.load(std::memory_order_relaxed);
+   do {
+      if (cur >= limit) {
+         return false;
+      }
+      std::size_t chunk = std::max(grain, (limit - cur) / participants);
+      chunk_end = std::min(cur + chunk, limit);
+   } while (!next.compare_exchange_weak(cur, chunk_end, std::memory_order_relaxed));
+   chunk_begin = cur;
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ParallelForState::work(std::size_t limit) {
+   std::size_t chunk_begin, chunk_end;
+   while (grab(limit, chunk_begin, chunk_end)) {
+      kernel(chunk_begin, chunk_end);
+      completed.fetch_add(chunk_end - chunk_begin, std::memory_order_release);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ParallelFor::ParallelFor(WorkerPool& pool, std::size_t begin, std::size_t end, chunk_func kernel,
+                         ParallelForMode mode, std::size_t per_tick, std::size_t grain)
+   : state(std::make_shared<ParallelForState>())
+{
+   state->pool = &pool;
+   state->kernel = std::move(kernel);
+   state->begin = begin;
+   state->end = std::max(begin, end);
+   state->per_tick = per_tick;
+   state->grain = std::max<std::size_t>(grain, 1);
+   state->mode = mode;
+   state->next.store(begin, std::memory_order_relaxed);
+   state->completed.store(0, std::memory_order_relaxed);
+   state->pending.store(0, std::memory_order_relaxed);
+   state->limit = begin;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Copies (e.g. prefab instances) start over at the beginning of
+///         the range with their own progress, so that two ops never claim
+///         chunks from the same state.
+ParallelFor::ParallelFor(const ParallelFor& other)
+   : ParallelFor(*other.state->pool, other.state->begin, other.state->end, other.state->kernel,
+                 other.state->mode, other.state->per_tick, other.state->grain)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+ParallelFor& ParallelFor::operator=(const ParallelFor& other) {
+   ParallelFor copy(other);
+   state = std::move(copy.state);
+   return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Executes a kernel over the range [begin, end), split into chunks
+///         which are processed in parallel by a WorkerPool.
+///
+/// \details The kernel is passed the bounds of a chunk; use
+///         op::for_each_element() to adapt a function which processes a
+///         single element at a time.
+///
+///         In ParallelForMode::blocking, the calling thread helps process
+///         chunks, and does not return until the work for this call is
+///         complete.  If per_tick is 0, the whole range is processed in one
+///         call.  Otherwise, at most per_tick elements are processed per
+///         call, and the range is spread across several ticks.
+///
+///         In ParallelForMode::background, the first call posts the whole
+///         range to the pool and returns immediately.  Subsequent calls only
+///         check whether the work has finished.  If the pool has no worker
+///         threads, each call processes one chunk on the calling thread
+///         instead.
+///
+///         While there is work left, the op's remaining() time will be -1.
+///         Once the entire range has been processed, it will be set to 0.
+///
+///         When called with a dt of 0, the range will be restarted from the
+///         beginning, unless a background run is still in progress.
+void ParallelFor::operator()(OpData& data, F64& dt) {
+   ParallelForState& s = *state;
+   const std::size_t total = s.end - s.begin;
+
+   if (dt == 0) {
+      if (s.pending.load(std::memory_order_acquire) == 0) {
+         s.next.store(s.begin, std::memory_order_relaxed);
+         s.completed.store(0, std::memory_order_relaxed);
+         s.limit = s.begin;
+         s.started = false;
+         data.remaining = total > 0 ? -1 : 0;
+      }
+      return;
+   }
+
+   if (s.mode == ParallelForMode::background) {
+      if (!s.started) {
+         start_(s.end);
+      }
+      if (s.pool->size() == 0) {
+         std::size_t chunk_begin, chunk_end;
+         if (s.grab(s.limit, chunk_begin, chunk_end)) {
+            s.kernel(chunk_begin, chunk_end);
+            s.completed.fetch_add(chunk_end - chunk_begin, std::memory_order_release);
+         }
+      }
+   } else {
+      std::size_t done = s.completed.load(std::memory_order_acquire);
+      if (done < total) {
+         std::size_t limit = s.end;
+         if (s.per_tick > 0) {
+            limit = std::min(s.end, s.begin + done + s.per_tick);
+         }
+
+         start_(limit);
+         s.work(limit);
+
+         // wait for every posted task to exit, not just for the range to be
+         // covered, so that no worker touches the kernel outside of this call
+         while (s.pending.load(std::memory_order_acquire) > 0) {
+            if (!s.pool->run_one()) {
+               std::this_thread::yield();
+            }
+         }
+      }
+   }
+
+   data.remaining = s.completed.load(std::memory_order_acquire) < total ? -1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ParallelFor::start_(std::size_t limit) {
+   ParallelForState& s = *state;
+   s.limit = limit;
+   s.started = true;
+
+   std::size_t chunks = (limit - s.next.load(std::memory_order_relaxed) + s.grain - 1) / s.grain;
+   std::size_t tasks = std::min(s.pool->size(), chunks);
+   s.pending.fetch_add(tasks, std::memory_order_relaxed);
+
+   std::shared_ptr<ParallelForState> ptr = state;
+   for (std::size_t i = 0; i < tasks; ++i) {
+      s.pool->post([ptr, limit]() {
+         ptr->work(limit);
+         ptr->pending.fetch_sub(1, std::memory_order_release);
+      });
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Orders the children longest-first and groups them into batches.
+///
+/// \details Children are sorted by descending cost (see Op::cost()), which
+///         for a set of siblings is also their critical path, since each
+///         child's cost includes its descendants.  Starting the longest
+///         children first keeps one dominant child from finishing last on an
+///         otherwise idle pool.  Children which cost at least 1/4 of an even
+///         share per worker get a batch to themselves; cheaper ones are
+///         packed together until each batch reaches that size, so that
+///         trivial children don't each pay for a task.  Before any costs
+///         have been measured, children are split into equally sized
+///         batches instead.
+void ParallelSetState::plan(OpData& data, std::size_t workers) {
+   auto& children = data.children;
+   const std::size_t n = children.size();
+   const std::size_t target_batches = workers * 4;
+
+   ops.clear();
+   batches.clear();
+
+   F64 total = 0;
+   for (Op& op : children) {
+      ops.push_back(&op);
+      total += op.cost();
+   }
+
+   if (total <= 0) {
+      std::size_t size = std::max<std::size_t>(1, (n + target_batches - 1) / target_batches);
+      for (std::size_t i = 0; i < n; i += size) {
+         batches.push_back(batch { i, std::min(n, i + size) });
+      }
+      return;
+   }
+
+   std::stable_sort(ops.begin(), ops.end(), [](const Op* a, const Op* b) {
+      return a->cost() > b->cost();
+   });
+
+   const F64 target = total / target_batches;
+   std::size_t begin = 0;
+   F64 accumulated = 0;
+   for (std::size_t i = 0; i < n; ++i) {
+      accumulated += ops[i]->cost();
+      if (accumulated >= target) {
+         batches.push_back(batch { begin, i + 1 });
+         begin = i + 1;
+         accumulated = 0;
+      }
+   }
+   if (begin < n) {
+      batches.push_back(batch { begin, n });
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Claims and runs batches until there are none left, measuring
+///         each child as it runs.
+void ParallelSetState::work() {
+   for (;;) {
+      std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+      if (index >= batches.size()) {
+         return;
+      }
+
+      const batch& b = batches[index];
+      for (std::size_t i = b.begin; i < b.end; ++i) {
+         Op& op = *ops[i];
+         F64 mdt = dt;
+         auto start = std::chrono::steady_clock::now();
+         op(mdt);
+         record_cost(op.data_, std::chrono::duration<F64>(std::chrono::steady_clock::now() - start).count(), weight);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Calls work() from a pool task.
+///
+/// \details Invocations made by the task are moved from the running
+///         thread's count to invocations, so that the thread which started
+///         the tick can claim them, no matter which thread ran the task.
+void ParallelSetState::work_task() {
+   U64& count = invocation_count();
+   U64 before = count;
+   work();
+   invocations.fetch_add(count - before, std::memory_order_relaxed);
+   count = before;
+   pending.fetch_sub(1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ParallelSet::ParallelSet(WorkerPool& pool, F64 weight)
+   : pool(&pool),
+     weight(weight),
+     state(std::make_shared<ParallelSetState>())
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Copies start with their own (empty) scheduling state, since the
+///         state refers to the original's children.
+ParallelSet::ParallelSet(const ParallelSet& other)
+   : pool(other.pool),
+     weight(other.weight),
+     state(std::make_shared<ParallelSetState>())
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+ParallelSet& ParallelSet::operator=(const ParallelSet& other) {
+   pool = other.pool;
+   weight = other.weight;
+   state = std::make_shared<ParallelSetState>();
+   return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Works like op::detail::StaticSet, but runs its children in
+///         parallel on a WorkerPool, scheduled by their measured costs.
+///
+/// \details Each tick, the children are planned into batches (see
+///         ParallelSetState::plan()), which the calling thread and the
+///         pool's workers claim in longest-first order.  The call does not
+///         return until every child has run.  Each child's run time is
+///         measured and folded into its cost estimate, which can be
+///         inspected or overridden through op::Opus::cost().
+///
+///         Children run concurrently with each other, so they must not write
+///         state which their siblings read during the same tick; see
+///         op::Opus::published() and op::BufferedState.  Resets (dt == 0)
+///         are run sequentially.
+void ParallelSet::operator()(OpData& data, F64& dt) {
+   if (dt == 0) {
+      for (Op& op : data.children) {
+         F64 mdt = dt;
+         op(mdt);
+      }
+      return;
+   }
+
+   ParallelSetState& s = *state;
+   s.weight = weight;
+   s.dt = dt;
+   s.plan(data, pool->size() + 1);
+   s.next.store(0, std::memory_order_relaxed);
+   s.invocations.store(0, std::memory_order_relaxed);
+
+   std::size_t tasks = std::min(pool->size(), s.batches.size() > 0 ? s.batches.size() - 1 : 0);
+   s.pending.store(tasks, std::memory_order_relaxed);
+
+   std::shared_ptr<ParallelSetState> ptr = state;
+   for (std::size_t i = 0; i < tasks; ++i) {
+      pool->post([ptr]() {
+         ptr->work_task();
+      });
+   }
+
+   s.work();
+
+   while (s.pending.load(std::memory_order_acquire) > 0) {
+      if (!pool->run_one()) {
+         std::this_thread::yield();
+      }
+   }
+
+   invocation_count() += s.invocations.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards every child by dt, sequentially.
+void ParallelSet::advance(OpData& data, F64& dt, F64 step_size) {
+   for (Op& op : data.children) {
+      F64 mdt = dt;
+      op.advance(mdt, step_size);
+   }
+}
+
+} // be::op::detail
+} // be::op
+} // be
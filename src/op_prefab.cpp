@@ -0,0 +1,122 @@
+#include "pch.hpp"
+#include "op_prefab.hpp"
+#include "logging.hpp"
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Constructs a prefab containing only a root node, whose action is
+///         an op::detail::StaticSet.
+Prefab::Prefab()
+   : Prefab(detail::StaticSet())
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Constructs a prefab containing only a root node.
+///
+/// \details The root node's relative Id is always Id().  When the prefab is
+///         instantiated, the root node takes on the instance Id passed to
+///         Opus::instantiate().
+Prefab::Prefab(OpData::action_func root_action, F64 remaining, F64 total)
+   : sealed_(false)
+{
+   node root;
+   root.remaining = remaining;
+   root.total = total;
+   root.action = std::move(root_action);
+   nodes_.push_back(std::move(root));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Adds a node to the prefab template.
+///
+/// \details parent_id and child_id are relative to the prefab; they are
+///         combined with the instance Id when the prefab is instantiated (see
+///         Prefab::id()).  Nodes may be added in any order, as long as every
+///         parent has been added by the time the prefab is registered with an
+///         Opus.
+void Prefab::child(Id parent_id, Id child_id, I32 priority, OpData::action_func action, F64 remaining, F64 total) {
+   assert((U64)child_id);
+
+   node n;
+   n.id = child_id;
+   n.parent = parent_id;
+   n.priority = priority;
+   n.remaining = remaining;
+   n.total = total;
+   n.action = std::move(action);
+   nodes_.push_back(std::move(n));
+   sealed_ = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t Prefab::size() const {
+   return nodes_.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Calculates the Id that a prefab node will be assigned when the
+///         prefab is instantiated as instance_id.
+Id Prefab::id(Id instance_id, Id relative_id) {
+   if (!(U64)relative_id) {
+      return instance_id;
+   }
+
+   U64 h = (U64)instance_id;
+   h ^= (U64)relative_id + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+   return Id(h);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Lays out the nodes of the prefab breadth-first, so that each
+///         node's children are contiguous and sorted by descending priority.
+///
+/// \details This is the same ordering that Opus::clean_() would produce, so
+///         instances never need to be re-sorted after they are created.
+void Prefab::seal_() {
+   if (sealed_) {
+      return;
+   }
+
+   node_list sorted;
+   sorted.reserve(nodes_.size());
+   sorted.push_back(std::move(nodes_.front()));
+
+   std::vector<bool> placed(nodes_.size(), false);
+   placed[0] = true;
+
+   for (std::size_t i = 0; i < sorted.size(); ++i) {
+      Id parent_id = sorted[i].id;
+      std::size_t first = sorted.size();
+
+      for (std::size_t j = 1; j < nodes_.size(); ++j) {
+         if (!placed[j] && nodes_[j].parent == parent_id) {
+            placed[j] = true;
+            sorted.push_back(std::move(nodes_[j]));
+         }
+      }
+
+      std::stable_sort(sorted.begin() + first, sorted.end(), [](const node& a, const node& b) {
+         return a.priority > b.priority;
+      });
+
+      sorted[i].first_child = first;
+      sorted[i].child_count = sorted.size() - first;
+   }
+
+   for (std::size_t j = 1; j < nodes_.size(); ++j) {
+      if (!placed[j]) {
+         be_error() << "Prefab node's parent does not exist!"
+            & attr(ids::log_attr_op_id) << nodes_[j].id
+            & attr(ids::log_attr_parent_id) << nodes_[j].parent
+            | default_log();
+      }
+   }
+
+   nodes_ = std::move(sorted);
+   sealed_ = true;
+}
+
+} // be::op
+} // be
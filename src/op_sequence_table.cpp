@@ -0,0 +1,149 @@
+#include "pch.hpp"
+#include "op_sequence_table.hpp"
+
+namespace be {
+namespace op {
+namespace detail {
+
+constexpr U32 SequenceIndex::none;
+
+///////////////////////////////////////////////////////////////////////////////
+U32 SequenceIndex::create() {
+   U32 sequence;
+   if (free_sequences.empty()) {
+      sequence = (U32)first.size();
+      first.push_back(none);
+      last.push_back(none);
+      cursor.push_back(none);
+      live.push_back(1);
+      in_active.push_back(0);
+   } else {
+      sequence = free_sequences.back();
+      free_sequences.pop_back();
+      live[sequence] = 1;
+   }
+   return sequence;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Allocates a step and links it to the end of a sequence.
+///
+/// \details If the sequence has finished (or has no steps), its cursor is
+///         moved to the new step and it is added back to the active list.
+///
+/// \return The index of the new step; if it is equal to next.size() - 1 and
+///         was just added, the caller must grow its own per-step arrays.
+U32 SequenceIndex::append(U32 sequence) {
+   assert(valid(sequence));
+
+   U32 step;
+   if (free_steps != none) {
+      step = free_steps;
+      free_steps = next[step];
+      next[step] = none;
+   } else {
+      step = (U32)next.size();
+      next.push_back(none);
+   }
+   ++step_count;
+
+   if (last[sequence] != none) {
+      next[last[sequence]] = step;
+   } else {
+      first[sequence] = step;
+   }
+   last[sequence] = step;
+
+   if (cursor[sequence] == none) {
+      cursor[sequence] = step;
+      if (!in_active[sequence]) {
+         in_active[sequence] = 1;
+         active.push_back(sequence);
+      }
+   }
+   return step;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Detaches every step from a sequence.
+///
+/// \details The sequence is left in the active list (if it is there) until
+///         the next tick, which will drop it since its cursor is none.
+///
+/// \return The first of the detached steps, which are still linked
+///         together; pass it to release() once the caller has reset its own
+///         per-step data.
+U32 SequenceIndex::clear(U32 sequence) {
+   assert(valid(sequence));
+   U32 steps = first[sequence];
+   first[sequence] = none;
+   last[sequence] = none;
+   cursor[sequence] = none;
+   return steps;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns a chain of steps detached by clear() to the free list.
+void SequenceIndex::release(U32 steps) {
+   if (steps == none) {
+      return;
+   }
+
+   U32 tail = steps;
+   --step_count;
+   while (next[tail] != none) {
+      tail = next[tail];
+      --step_count;
+   }
+   next[tail] = free_steps;
+   free_steps = steps;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Marks a sequence (which must already have been cleared) as free
+///         to be reused.
+void SequenceIndex::erase(U32 sequence) {
+   live[sequence] = 0;
+   free_sequences.push_back(sequence);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void SequenceIndex::rewind(U32 sequence) {
+   if (!live[sequence]) {
+      return;
+   }
+   cursor[sequence] = first[sequence];
+   if (cursor[sequence] != none && !in_active[sequence]) {
+      in_active[sequence] = 1;
+      active.push_back(sequence);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void SequenceIndex::rewind() {
+   for (U32 sequence = 0, n = (U32)first.size(); sequence < n; ++sequence) {
+      rewind(sequence);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool SequenceIndex::valid(U32 sequence) const {
+   return sequence < live.size() && live[sequence];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns true if the sequence has no steps left to run (or does
+///         not exist).
+bool SequenceIndex::finished(U32 sequence) const {
+   return !valid(sequence) || cursor[sequence] == none;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t SequenceIndex::heap_size() const {
+   return (first.capacity() + last.capacity() + cursor.capacity() + next.capacity() + active.capacity() + free_sequences.capacity()) * sizeof(U32)
+      + (live.capacity() + in_active.capacity()) * sizeof(U8);
+}
+
+} // be::op::detail
+} // be::op
+} // be
@@ -0,0 +1,156 @@
+#include "pch.hpp"
+#include "op_signal.hpp"
+#include "opus.hpp"
+
+namespace be {
+namespace op {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Signals are owned by an Opus; use Opus::signal() to create them.
+///
+/// \details The list of fired signals is shared with the Opus, so a signal
+///         kept alive by an op::detail::WaitFor can still be fired safely
+///         after its Opus has been destroyed; nothing will ever wake.
+Signal::Signal(std::shared_ptr<std::atomic<Signal*>> fired_list)
+   : fired_(std::move(fired_list)),
+     queued_(false),
+     fires_(0),
+     wakes_(0),
+     next_(nullptr)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Wakes every op currently waiting on this signal.
+///
+/// \details Can be called from any thread.  The signal is pushed onto its
+///         Opus' lock-free list of fired signals (unless it is already
+///         there), and the waiting ops are woken all at once at the start of
+///         the next tick.  Only ops which began waiting before the call are
+///         woken; an op which starts waiting afterwards, even during the
+///         same tick, waits for the next call to fire().
+void Signal::fire() {
+   fires_.fetch_add(1);
+   if (!queued_.exchange(true)) {
+      Signal* head = fired_->load(std::memory_order_relaxed);
+      do {
+         next_ = head;
+      } while (!fired_->compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the number of ops currently waiting on this signal,
+///         whether parked by Opus::wait() or blocked in place by
+///         Opus::wait_for().
+///
+/// \details Must only be called from the thread which runs the Opus, and
+///         not while it is running a tick.
+std::size_t Signal::waiting() const {
+   std::lock_guard<std::mutex> lock(watchers_mutex_);
+   return waiters_.size() + watchers_.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the number of times a call to fire() has been processed
+///         by the Opus.
+///
+/// \details Incremented at the start of the tick after the signal fires,
+///         when its waiters are woken.  Can be read from ops running in
+///         parallel during a tick, since it only changes between ticks.
+U64 Signal::wakes() const {
+   return wakes_.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Registers an op to be woken by the next call to fire().
+///
+/// \details Records how many times the signal has fired so far, so that the
+///         Opus only wakes the op for a later call.  Does nothing if the op is
+///         already registered.  May be called from any thread running the
+///         op.
+void Signal::watch_(Id id) {
+   std::lock_guard<std::mutex> lock(watchers_mutex_);
+   for (auto& watcher : watchers_) {
+      if (watcher.first == id) {
+         return;
+      }
+   }
+   watchers_.push_back(std::make_pair(id, fires_.load()));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Signal::unwatch_(Id id) {
+   std::lock_guard<std::mutex> lock(watchers_mutex_);
+   auto it = std::find_if(watchers_.begin(), watchers_.end(), [=](const std::pair<Id, U64>& watcher) { return watcher.first == id; });
+   if (it != watchers_.end()) {
+      *it = watchers_.back();
+      watchers_.pop_back();
+   }
+}
+
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Use Opus::wait_for() to make an op wait for one of an Opus'
+///         signals.
+///
+/// \details The signal is shared, so the op remains safe to run even if the
+///         Opus is moved, or the op is extracted from it.
+WaitFor::WaitFor(std::shared_ptr<Signal> signal, Id id)
+   : signal(std::move(signal)),
+     id(id)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Blocks until a signal is fired.
+///
+/// \details The first time the op is run, it registers itself with the
+///         signal and sets its remaining() time to -1.  It does not check the
+///         signal again; when the signal next fires, the Opus sets the op's
+///         remaining() time to 0 at the start of the following tick.  The op
+///         is not removed from its parent while it waits, so it is safe to
+///         use as a step in an op::detail::Queue.  Containers which stop at a
+///         blocked child (like a Queue) still call it once per tick, which
+///         returns immediately.
+///
+///         If the op is restarted after it was woken (by setting its
+///         remaining() time to something other than 0), it registers itself
+///         again the next time it is run.  When called with a dt of 0, the op
+///         is reset, so that the next call will wait for the next time the
+///         signal fires.
+void WaitFor::operator()(OpData& data, F64& dt) {
+   if (dt == 0) {
+      if (armed) {
+         signal->unwatch_(id);
+         armed = false;
+      }
+      data.remaining = -1;
+      return;
+   }
+
+   if (!armed) {
+      armed = true;
+      data.remaining = -1;
+      signal->watch_(id);
+   } else if (data.revision != revision && data.remaining != 0) {
+      signal->watch_(id);
+   }
+   revision = data.revision;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Fast-forwards the op by dt.
+///
+/// \details Signals are only processed between ticks, so the op can never
+///         complete during a fast-forward; the whole span is consumed while
+///         waiting.
+void WaitFor::advance(OpData& data, F64& dt, F64 step_size) {
+   BE_IGNORE(step_size);
+   F64 mdt = dt;
+   (*this)(data, mdt);
+   dt = 0;
+}
+
+} // be::op::detail
+} // be::op
+} // be
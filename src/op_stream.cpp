@@ -0,0 +1,204 @@
+#include "pch.hpp"
+#include "op_stream.hpp"
+
+namespace be {
+namespace op {
+namespace detail {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Moves keep the right to consume the stream (see operator());
+///         copies do not.
+StreamQueue::StreamQueue(StreamQueue&& other)
+   : state(other.state)
+{
+   const StreamQueue* expected = &other;
+   state->consumer.compare_exchange_strong(expected, this);
+   other.state.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+StreamQueue& StreamQueue::operator=(const StreamQueue& other) {
+   if (this != &other) {
+      release_();
+      state = other.state;
+   }
+   return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+StreamQueue& StreamQueue::operator=(StreamQueue&& other) {
+   if (this != &other) {
+      release_();
+      state = other.state;
+      const StreamQueue* expected = &other;
+      state->consumer.compare_exchange_strong(expected, this);
+      other.state.reset();
+   }
+   return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+StreamQueue::~StreamQueue() {
+   release_();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Gives up the right to consume the stream, so that another copy
+///         can take it.
+void StreamQueue::release_() {
+   if (state) {
+      const StreamQueue* expected = this;
+      state->consumer.compare_exchange_strong(expected, nullptr);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Executes ops pushed into a Stream one at a time, in the order they
+///         were pushed.
+///
+/// \details Works like op::detail::Queue, except that instead of looking at
+///         the op's children, it pops ops from the stream's ring buffer as
+///         each previous op completes.  Several ops may be started and
+///         finished in a single call as long as there is dt remaining.
+///
+///         While the stream is open, the op's remaining() time is always -1,
+///         even if there are currently no ops waiting.  Once the stream has
+///         been closed and every pushed op has completed, remaining() will be
+///         set to 0.
+///
+///         When called with a dt of 0, the current op (if any) is called with
+///         a dt of 0.  Since ops are discarded as they finish, the stream
+///         can't be rewound.
+///
+///         The ring buffer can only have one consumer, so if the op function
+///         has been copied (for example into a prefab), the first copy to run
+///         claims the stream until it is destroyed.  Any other copy behaves
+///         as if the stream were always empty.
+void StreamQueue::operator()(OpData& data, F64& dt) {
+   StreamState& s = *state;
+
+   if (s.consumer.load(std::memory_order_acquire) != this) {
+      const StreamQueue* expected = nullptr;
+      if (!s.consumer.compare_exchange_strong(expected, this)) {
+         data.remaining = s.closed.load(std::memory_order_acquire) ? 0 : -1;
+         return;
+      }
+   }
+
+   if (dt == 0) {
+      if (s.active) {
+         s.current(dt);
+      }
+      return;
+   }
+
+   while (dt > 0) {
+      if (!s.active) {
+         if (!s.ring.try_pop(s.current)) {
+            bool closed = s.closed.load(std::memory_order_acquire);
+            // an op may have been pushed just before the stream was closed
+            if (!closed || !s.ring.try_pop(s.current)) {
+               data.remaining = closed ? 0 : -1;
+               return;
+            }
+         }
+         s.active = true;
+      }
+
+      Op& op = s.current;
+      if (op.remaining()) {
+         data.remaining = -1;
+         op(dt);
+         if (op.remaining()) {
+            return;
+         }
+      }
+      s.active = false;
+   }
+}
+
+} // be::op::detail
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Creates a new stream which can hold up to capacity pending ops.
+///
+/// \details Use action() to create an op function that will execute the ops
+///         pushed into the stream.  The Stream object and any op functions
+///         created from it share ownership of the ring buffer, but only one
+///         op function at a time executes the pushed ops.
+Stream::Stream(std::size_t capacity)
+   : state_(std::make_shared<detail::StreamState>(capacity))
+{ }
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Enqueues an op to be run after all previously pushed ops.
+///
+/// \details Can be called from any thread, without locking and without
+///         allocating.  If the stream's ring buffer is full, false is
+///         returned, op is left untouched, and the rejected() counter is
+///         incremented.
+///
+///         The op must not be part of an Opus hierarchy or be referenced by
+///         any Handle, since it will be moved on the consuming thread.
+bool Stream::push(Op&& op) {
+   if (state_->ring.try_push(std::move(op))) {
+      return true;
+   }
+   state_->rejected.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Enqueues an op which will call func.
+///
+/// \details If func is too large to be stored inline in an
+///         OpData::action_func, the conversion (but not the push itself) will
+///         allocate.
+bool Stream::push(OpData::action_func func, F64 remaining, F64 total) {
+   OpData data;
+   data.remaining = remaining;
+   data.total = total;
+   data.action = std::move(func);
+   Op op(std::move(data));
+   return push(std::move(op));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Indicates that no more ops will be pushed.
+///
+/// \details Once all pending ops have completed, the stream's queue op will
+///         set its remaining() time to 0.
+void Stream::close() {
+   state_->closed.store(true, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Stream::closed() const {
+   return state_->closed.load(std::memory_order_acquire);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the number of pushes that have failed because the ring
+///         buffer was full.
+U64 Stream::rejected() const {
+   return state_->rejected.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the approximate number of ops waiting in the ring buffer.
+std::size_t Stream::size() const {
+   return state_->ring.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t Stream::capacity() const {
+   return state_->ring.capacity();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+detail::StreamQueue Stream::action() const {
+   return detail::StreamQueue(state_);
+}
+
+} // be::op
+} // be
@@ -1,14 +1,42 @@
 #include "pch.hpp"
 #include "opus.hpp"
+#include "opus_recorder.hpp"
 #include "logging.hpp"
+#include <chrono>
+#include <unordered_set>
 
 namespace be {
 namespace op {
 
+///////////////////////////////////////////////////////////////////////////////
+OpSubtree::OpSubtree() { }
+
+///////////////////////////////////////////////////////////////////////////////
+Id OpSubtree::id() const {
+   return nodes_.empty() ? Id() : nodes_.front().id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t OpSubtree::size() const {
+   return nodes_.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool OpSubtree::empty() const {
+   return nodes_.empty();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 Opus::Opus(op_generator op_gen)
    : root_(op_gen(Id())),
+     fired_(new std::atomic<Signal*>(nullptr)),
+     index_(new tree_index()),
      dirty_(false),
+     recorder_(nullptr),
+     metrics_(new OpusMetrics()),
+     mutations_(0),
+     clean_lists_(0),
+     clean_children_(0),
      op_gen_(std::move(op_gen))
 {
    op_meta rootMeta;
@@ -18,10 +46,75 @@ Opus::Opus(op_generator op_gen)
 
 ///////////////////////////////////////////////////////////////////////////////
 F64 Opus::operator()(F64 dt) {
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::tick;
+      event.dt = dt;
+      recorder_->record(event);
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   U64 invocations = detail::invocation_count();
+
+   wake_();
+   resolve_domains_(dt);
    if (dirty_) {
       clean_();
    }
    root_(dt);
+   publish_();
+
+   // the root op itself is not counted
+   invocations = detail::invocation_count() - invocations - 1;
+   U64 ns = (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   metrics_->record_tick(ns, invocations, mutations_);
+   mutations_ = 0;
+   return dt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Advances the whole hierarchy by dt as quickly as possible.
+///
+/// \details Useful for catching up after a long pause, such as when a
+///         hibernated world is resumed.  Ops whose actions provide an
+///         advance() hook (see op::detail::HasAdvance) are advanced by the
+///         whole span in one call; containers like op::detail::Queue and
+///         op::detail::Set forward the span to their children.  Ops without
+///         a hook are called repeatedly with dt values no larger than
+///         step_size, so they never see a larger step than they would during
+///         normal play at that rate.
+///
+///         Signals and pending structural changes are processed first, just
+///         as they would be by operator().  Divisor and frequency scheduling
+///         is bypassed: scheduled ops are advanced by the whole span plus
+///         whatever dt they had accumulated.
+F64 Opus::fast_forward(F64 dt, F64 step_size) {
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::fast_forward;
+      event.dt = dt;
+      event.step_size = step_size;
+      recorder_->record(event);
+   }
+
+   auto start = std::chrono::steady_clock::now();
+   U64 invocations = detail::invocation_count();
+
+   wake_();
+   resolve_domains_(dt);
+   if (dirty_) {
+      clean_();
+   }
+   // the root op may be stepped many times; none of its own calls are
+   // counted, as in operator()
+   U64 root_calls = detail::advance(root_.data_.action, root_.data_.traits, root_.data_, dt, step_size);
+   publish_();
+
+   // recorded as a single tick, however many steps it took
+   invocations = detail::invocation_count() - invocations - root_calls;
+   U64 ns = (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   metrics_->record_tick(ns, invocations, mutations_);
+   mutations_ = 0;
    return dt;
 }
 
@@ -32,6 +125,19 @@ Op& Opus::root() {
 
 ///////////////////////////////////////////////////////////////////////////////
 Op& Opus::operator[](Id id) {
+   // recreating an op whose Op object has died is also a creation, and
+   // must be recorded or a replay will not have the op
+   auto it = meta_.find(id);
+   if (it == meta_.end() || !it->second.op) {
+      ++mutations_;
+      if (recorder_) {
+         OpusLogEvent event;
+         event.type = OpusLogEventType::create;
+         event.id = id;
+         recorder_->record(event);
+      }
+   }
+
    return *get_or_create_with_op_(id).op;
 }
 
@@ -65,8 +171,18 @@ Opus::iterator Opus::end(Id id) const {
 
 ///////////////////////////////////////////////////////////////////////////////
 Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
+   ++mutations_;
    assert((U64)child_id);
 
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::child;
+      event.id = child_id;
+      event.other_id = parent_id;
+      event.priority = priority;
+      recorder_->record(event);
+   }
+
    op_meta* parent = nullptr;
    op_meta* meta;
 
@@ -97,16 +213,24 @@ Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
          parent->children.push_back(child_id);
          parent->children_dirty = true;
          dirty_ = true;
+         index_->valid = false;
 
-         if (old_parent.op) {
+         if (old_parent.op && !(U64)meta->signal) {
             // if old parent is alive, see if we need to move the op
+            // (waiting ops will be moved to their new parent when woken)
             Op* op = meta->op.get();
             if (op) {
+               release_children_(meta->parent);
                auto& old_children = old_parent.op->data_.children;
                auto it3 = std::find_if(old_children.begin(), old_children.end(), [=](const Op& child) { return &child == op; });
                if (it3 != old_children.end()) {
-                  parent->op->data_.children.push_back(std::move(*it3));
+                  // old_children may be inside an op that moves when the
+                  // new parent's children are reallocated; erase first.
+                  Op moved(std::move(*it3));
                   old_children.erase(it3);
+                  parent->op->data_.children.push_back(std::move(moved));
+                  ++parent->op->data_.revision;
+                  ++old_parent.op->data_.revision;
                } else {
                   // something's wrong...
                   be_error() << "Op not found in old parent!"
@@ -121,6 +245,8 @@ Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
          }
          
          meta->parent = parent_id;
+         meta->staggered = false;
+         unnest_domains_(child_id);
       }
 
       if (meta->priority != priority) {
@@ -130,6 +256,7 @@ Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
          }
          parent->children_dirty = true;
          dirty_ = true;
+         index_->valid = false;
       }
 
       if (meta->op) {
@@ -138,8 +265,13 @@ Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
    } else {
       // doesn't exist yet; create it.
       op_meta newMeta;
+      newMeta.parent = parent_id;
+      newMeta.priority = priority;
       auto result = meta_.emplace(child_id, newMeta);
       meta = &result.first->second;
+
+      parent = &get_or_create_with_op_(parent_id);
+      parent->children.push_back(child_id);
    }
 
    if (!parent) {
@@ -148,8 +280,11 @@ Op& Opus::child(Id parent_id, Id child_id, I32 priority) {
 
    auto& children = parent->op->data_.children;
    children.push_back(op_gen_(child_id));
+   metrics_->record_created(1);
+   ++parent->op->data_.revision;
    parent->children_dirty = true;
    dirty_ = true;
+   index_->valid = false;
    meta->op = static_cast<Handle<Op>>(children.back());
 
    return children.back();
@@ -184,6 +319,15 @@ Id Opus::parent(Id child_id) const {
 
 ///////////////////////////////////////////////////////////////////////////////
 Id Opus::parent(Id child_id, Id new_parent_id) {
+   ++mutations_;
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::parent;
+      event.id = child_id;
+      event.other_id = new_parent_id;
+      recorder_->record(event);
+   }
+
    op_meta& meta = get_or_create_(child_id);
    Id old_parent_id = meta.parent;
    
@@ -210,16 +354,24 @@ Id Opus::parent(Id child_id, Id new_parent_id) {
       parent.children.push_back(child_id);
       parent.children_dirty = true;
       dirty_ = true;
+      index_->valid = false;
 
-      if (old_parent.op) {
+      if (old_parent.op && !(U64)meta.signal) {
          // if old parent is alive, see if we need to move the op
+         // (waiting ops will be moved to their new parent when woken)
          Op* op = meta.op.get();
          if (op) {
+            release_children_(old_parent_id);
             auto& old_children = old_parent.op->data_.children;
             auto it2 = std::find_if(old_children.begin(), old_children.end(), [=](const Op& child) { return &child == op; });
             if (it2 != old_children.end()) {
-               parent.op->data_.children.push_back(std::move(*it2));
+               // old_children may be inside an op that moves when the
+               // new parent's children are reallocated; erase first.
+               Op moved(std::move(*it2));
                old_children.erase(it2);
+               parent.op->data_.children.push_back(std::move(moved));
+               ++parent.op->data_.revision;
+               ++old_parent.op->data_.revision;
             } else {
                // something's wrong...
                be_error() << "Op not found in old parent!"
@@ -234,6 +386,8 @@ Id Opus::parent(Id child_id, Id new_parent_id) {
       }
 
       meta.parent = new_parent_id;
+      meta.staggered = false;
+      unnest_domains_(child_id);
    }
 
    return old_parent_id;
@@ -250,6 +404,15 @@ I32 Opus::priority(Id id) const {
 
 ///////////////////////////////////////////////////////////////////////////////
 I32 Opus::priority(Id id, I32 new_priority) {
+   ++mutations_;
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::priority;
+      event.id = id;
+      event.priority = new_priority;
+      recorder_->record(event);
+   }
+
    op_meta& meta = get_or_create_(id);
    I32 old_priority = meta.priority;
    
@@ -258,11 +421,428 @@ I32 Opus::priority(Id id, I32 new_priority) {
       op_meta& parent = get_or_create_(meta.parent);
       parent.children_dirty = true;
       dirty_ = true;
+      index_->valid = false;
    }
 
    return old_priority;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+U32 Opus::divisor(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return it->second.divisor;
+   }
+   return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Causes an op (and therefore its subtree) to be run only once
+///         every new_divisor times its parent runs it.
+///
+/// \details The op's action is wrapped in op::detail::Scheduled, which
+///         accumulates the dt values of the skipped calls and passes the
+///         total to the action when it does run.  A divisor of 0 or 1
+///         removes the wrapper (unless a frequency is also set).
+///
+///         Siblings which share the same divisor have their phases staggered
+///         by clean_() so that an even fraction of them run on each call.
+///
+///         Replacing the op's action directly will remove the wrapper until
+///         the next time its parent's children are re-sorted.
+U32 Opus::divisor(Id id, U32 new_divisor) {
+   op_meta& meta = get_or_create_with_op_(id);
+   U32 old_divisor = meta.divisor;
+
+   if (new_divisor == 0) {
+      new_divisor = 1;
+   }
+
+   if (meta.divisor != new_divisor) {
+      meta.divisor = new_divisor;
+      meta.staggered = false;
+      schedule_(meta);
+      op_meta& parent = get_or_create_(meta.parent);
+      parent.children_dirty = true;
+      dirty_ = true;
+   }
+
+   return old_divisor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+F64 Opus::frequency(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return it->second.frequency;
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Causes an op (and therefore its subtree) to be run at most
+///         new_frequency times per second of dt.
+///
+/// \details Works like divisor(Id, U32), but the op is scheduled based on the
+///         dt values passed to it rather than the number of times it is
+///         called.  Siblings which share the same frequency have their phases
+///         offset by an even fraction of the period.  A frequency of 0 or
+///         less removes the wrapper (unless a divisor is also set).
+F64 Opus::frequency(Id id, F64 new_frequency) {
+   op_meta& meta = get_or_create_with_op_(id);
+   F64 old_frequency = meta.frequency;
+
+   if (new_frequency < 0) {
+      new_frequency = 0;
+   }
+
+   if (meta.frequency != new_frequency) {
+      meta.frequency = new_frequency;
+      meta.staggered = false;
+      schedule_(meta);
+      op_meta& parent = get_or_create_(meta.parent);
+      parent.children_dirty = true;
+      dirty_ = true;
+   }
+
+   return old_frequency;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns an op's estimated cost in seconds; see Op::cost().
+F64 Opus::cost(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end() && it->second.op) {
+      return it->second.op->cost();
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Overrides an op's estimated cost.
+///
+/// \details While overridden, measurements will not change the estimate.
+///         Useful for giving schedulers like op::detail::ParallelSet a
+///         reasonable estimate before an op has ever been run.  Passing a
+///         negative value removes the override; the current estimate is kept
+///         as the starting point for further measurements.  If id does not
+///         refer to a live op, nothing is changed (an op is not created just
+///         to hold the override) and 0 is returned.
+///
+/// \return The previous estimate.
+F64 Opus::cost(Id id, F64 new_cost) {
+   auto it = meta_.find(id);
+   if (it == meta_.end() || !it->second.op) {
+      return 0;
+   }
+
+   OpData& data = it->second.op->data_;
+   F64 old_cost = std::abs(data.cost);
+
+   if (new_cost >= 0) {
+      // stored negated (even when 0) to mark it as an override
+      data.cost = -(F32)new_cost;
+   } else {
+      data.cost = (F32)old_cost;
+   }
+
+   return old_cost;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Opus::cost_overridden(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end() && it->second.op) {
+      return std::signbit(it->second.op->data_.cost);
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Retrieves the time domain with the specified Id, creating it if
+///         it does not exist.
+///
+/// \details Each time the Opus is run, the effective factor of every domain
+///         is calculated once: 0 if paused, otherwise the result of
+///         scale_func (if set) or scale.  The domain's dt and clock are also
+///         updated.  Ops bound to the domain (see domain(Id, Id)) are passed
+///         dt scaled by that factor, so an op's dt always matches its
+///         domain's.  When the factor becomes 0, the bound ops are moved out
+///         of their parents' child lists until it becomes non-zero again, so
+///         a paused subtree costs nothing per tick.  Ops which are steps of an
+///         op::detail::Queue are left in place (so the queue does not skip
+///         them) and return immediately instead.
+TimeDomain& Opus::time_domain(Id domain_id) {
+   auto& ptr = domains_[domain_id];
+   if (!ptr) {
+      ptr = std::make_shared<TimeDomain>();
+   }
+   return *ptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Id Opus::domain(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return it->second.domain;
+   }
+   return Id();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Binds an op (and therefore its subtree) to a time domain.
+///
+/// \details The op's action is wrapped in op::detail::DomainBound.  When the
+///         domain is paused, the op is parked (see time_domain()), so none of
+///         the op's descendants are visited.  Passing Id() as new_domain_id
+///         unbinds the op.  The domain will be created if it doesn't exist.
+///
+///         Domains can't be nested, since each bound op is passed its
+///         domain's dt, not a product of several factors.  Binding an op
+///         which has a bound ancestor or descendant logs an error and does
+///         nothing, and moving a bound op under a bound ancestor unbinds it.
+///
+///         Replacing the op's action directly will remove the binding.
+Id Opus::domain(Id id, Id new_domain_id) {
+   op_meta& meta = get_or_create_with_op_(id);
+   Id old_domain_id = meta.domain;
+   if (new_domain_id == old_domain_id) {
+      return old_domain_id;
+   }
+
+   if ((U64)new_domain_id && ((U64)enclosing_domain_(id) || bound_below_(id))) {
+      be_error() << "Time domains cannot be nested!"
+         & attr(ids::log_attr_op_id) << id
+         & attr(ids::log_attr_parent_id) << meta.parent
+         | default_log();
+      return old_domain_id;
+   }
+
+   if (meta.paused) {
+      unpark_(meta);
+   }
+
+   Op& op = *meta.op;
+   auto& action = op.data_.action;
+   domain_func* func = action.target<domain_func>();
+
+   if ((U64)new_domain_id) {
+      time_domain(new_domain_id);
+      if (!func) {
+         release_children_(meta.parent);
+         const ActionTraits* inner_traits = op.data_.traits;
+         action = domain_func(domains_[new_domain_id], std::move(action));
+         func = action.target<domain_func>();
+         func->inner_traits = inner_traits;
+         op.data_.traits = action_traits<domain_func>();
+         ++op.data_.revision;
+      } else {
+         func->domain = domains_[new_domain_id];
+      }
+   } else if (func) {
+      release_children_(meta.parent);
+      const ActionTraits* inner_traits = func->inner_traits;
+      OpData::action_func inner = std::move(static_cast<OpData::action_func&>(*func));
+      action = std::move(inner);
+      op.data_.traits = inner_traits;
+      ++op.data_.revision;
+   }
+
+   meta.domain = new_domain_id;
+   if ((U64)new_domain_id && domains_[new_domain_id]->factor == 0) {
+      pause_(id, meta);
+   }
+   return old_domain_id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Retrieves the signal with the specified Id, creating it if it
+///         does not exist.
+///
+/// \details The returned reference remains valid for the lifetime of the
+///         Opus.  Signal::fire() may be called from any thread.
+Signal& Opus::signal(Id signal_id) {
+   auto& ptr = signals_[signal_id];
+   if (!ptr) {
+      ptr.reset(new Signal(fired_));
+   }
+   return *ptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Suspends an op (and its subtree) until a signal is fired.
+///
+/// \details At the start of the next tick, the op is moved out of its
+///         parent's child list and onto the signal's wait list, so it costs
+///         nothing while it waits.  The next time the signal fires, the op is
+///         appended back to its parent's children and they are re-sorted.
+///
+///         Because the op is physically removed from its parent, this should
+///         only be used for children of ops which do not track positions in
+///         their child list, like op::detail::Set and op::detail::StaticSet.
+///         An op::detail::Queue will move on to its next child while one of
+///         its children is parked; use wait_for() for steps of a queue.
+///
+///         It is safe to call this from inside an op's action, including the
+///         action of the op that will wait.  If the signal fires after this
+///         call but before the op is parked, the op is not parked at all.
+void Opus::wait(Id id, Id signal_id) {
+   Signal& s = signal(signal_id);
+   pending_waits_.push_back(pending_wait { id, signal_id, s.fires_.load() });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Replaces an op's action with one which completes the next time a
+///         signal fires.
+///
+/// \details See op::detail::WaitFor.  The op stays in its parent's child
+///         list while it waits, so this is the way to block an
+///         op::detail::Queue on a signal.  The op starts waiting the first
+///         time it is run, and is woken by the Opus, so it never checks the
+///         signal itself.  Any time domain or schedule applied to the op is
+///         kept.
+void Opus::wait_for(Id id, Id signal_id) {
+   op_meta& meta = get_or_create_with_op_(id);
+   watch_(meta, id, signal_id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Opus::published(Id id) const {
+   return published_.count(id) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Enables or disables publishing of an op's remaining and total
+///         values.
+///
+/// \details While enabled, published_remaining() and published_total()
+///         return the op's values as of the end of the previous tick (or
+///         as of this call, until the first tick ends).  They do not change
+///         while the Opus is running, so ops which may run concurrently can
+///         read each other's progress without locks, and without the results
+///         depending on which op happened to run first.
+bool Opus::published(Id id, bool publish) {
+   bool old_value = published(id);
+   if (publish == old_value) {
+      return old_value;
+   }
+
+   if (publish) {
+      op_meta& meta = get_or_create_with_op_(id);
+      published_op entry { meta.op, meta.op->data_.remaining, meta.op->data_.total };
+      published_.emplace(id, std::move(entry));
+   } else {
+      published_.erase(id);
+   }
+
+   return old_value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+F64 Opus::published_remaining(Id id) const {
+   auto it = published_.find(id);
+   if (it != published_.end()) {
+      return it->second.remaining;
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+F64 Opus::published_total(Id id) const {
+   auto it = published_.find(id);
+   if (it != published_.end()) {
+      return it->second.total;
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Determines if ancestor_id is a strict ancestor of id.
+///
+/// \details Uses the hierarchy index, which is rebuilt (in O(n)) the first
+///         time it is needed after the hierarchy changes; after that, each
+///         query costs two hash lookups.  Every op is a descendant of the
+///         root, Id().  Returns false if either op does not exist.
+bool Opus::is_ancestor(Id ancestor_id, Id id) const {
+   const tree_index& index = tree_index_();
+   auto a = index.positions.find(ancestor_id);
+   auto b = index.positions.find(id);
+   if (a == index.positions.end() || b == index.positions.end()) {
+      return false;
+   }
+   return a->second < b->second && b->second < index.ends[a->second];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the number of ancestors an op has.  The root has depth
+///         0; ops which do not exist also return 0.
+U32 Opus::depth(Id id) const {
+   const tree_index& index = tree_index_();
+   auto it = index.positions.find(id);
+   if (it != index.positions.end()) {
+      return index.depths[it->second];
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns an iterator to the first descendant of an op.
+///
+/// \details Descendants are listed in pre-order: each op is followed by its
+///         own descendants before its next sibling, and siblings are in the
+///         same order as begin(Id)/end(Id).  The range is contiguous, and is
+///         invalidated by any change to the hierarchy.
+Opus::iterator Opus::descendants_begin(Id id) const {
+   const tree_index& index = tree_index_();
+   auto it = index.positions.find(id);
+   if (it != index.positions.end()) {
+      return index.ids.begin() + it->second + 1;
+   }
+   return iterator();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Opus::iterator Opus::descendants_end(Id id) const {
+   const tree_index& index = tree_index_();
+   auto it = index.positions.find(id);
+   if (it != index.positions.end()) {
+      return index.ids.begin() + index.ends[it->second];
+   }
+   return iterator();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Finds the deepest op which is an ancestor of (or the same as)
+///         both a and b.
+///
+/// \details If neither op is an ancestor of the other, the answer is the
+///         parent of the shallowest op between them in pre-order, which is
+///         found by scanning the index's contiguous depth array.  Returns
+///         Id() (the root) if either op does not exist.
+Id Opus::common_ancestor(Id a, Id b) const {
+   const tree_index& index = tree_index_();
+   auto ait = index.positions.find(a);
+   auto bit = index.positions.find(b);
+   if (ait == index.positions.end() || bit == index.positions.end()) {
+      return Id();
+   }
+
+   U32 first = std::min(ait->second, bit->second);
+   U32 last = std::max(ait->second, bit->second);
+   if (last < index.ends[first]) {
+      // first is an ancestor of last (or the same op)
+      return index.ids[first];
+   }
+
+   U32 shallowest = first + 1;
+   for (U32 i = shallowest + 1; i <= last; ++i) {
+      if (index.depths[i] < index.depths[shallowest]) {
+         shallowest = i;
+      }
+   }
+   return parent(index.ids[shallowest]);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 bool Opus::exists(Id id) const {
    return meta_.count(id) != 0;
@@ -270,13 +850,29 @@ bool Opus::exists(Id id) const {
 
 ///////////////////////////////////////////////////////////////////////////////
 void Opus::erase(Id id) {
+   ++mutations_;
+   if (recorder_) {
+      OpusLogEvent event;
+      event.type = OpusLogEventType::erase;
+      event.id = id;
+      recorder_->record(event);
+   }
+   erase_(id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::erase_(Id id) {
    auto it = meta_.find(id);
    if (it != meta_.end()) {
       op_meta& meta = it->second;
+      if (meta.op) {
+         metrics_->record_destroyed(1);
+      }
+      unwatch_(meta, id);
       
       // erase children
       while (!meta.children.empty()) {
-         erase(meta.children.back());
+         erase_(meta.children.back());
       }
 
       op_meta& parent = get_or_create_(meta.parent);
@@ -293,7 +889,17 @@ void Opus::erase(Id id) {
             | default_log();
       }
 
-      if (parent.op) {
+      if ((U64)meta.signal) {
+         // op is waiting on a signal or paused; remove it from the wait list
+         Op* op = meta.op.get();
+         Signal::waiter_list* waiters = parked_list_(meta);
+         if (op && waiters) {
+            auto it3 = std::find_if(waiters->begin(), waiters->end(), [=](const std::pair<Id, Op>& waiter) { return &waiter.second == op; });
+            if (it3 != waiters->end()) {
+               waiters->erase(it3);
+            }
+         }
+      } else if (parent.op) {
          // if old parent is alive, see if we need to remove the op
          Op* op = meta.op.get();
          if (op) {
@@ -301,6 +907,7 @@ void Opus::erase(Id id) {
             auto it3 = std::find_if(old_children.begin(), old_children.end(), [=](const Op& child) { return &child == op; });
             if (it3 != old_children.end()) {
                old_children.erase(it3);
+               ++parent.op->data_.revision;
             } else {
                // something's wrong...
                be_error() << "Op not found in parent!"
@@ -313,71 +920,559 @@ void Opus::erase(Id id) {
          }
       }
 
+      published_.erase(id);
+      index_->valid = false;
+
       // re-find() `it` since we might have erased other children and invalidated `it`
       meta_.erase(meta_.find(id));
    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-Opus::op_meta& Opus::get_or_create_(Id id) {
-   auto it = meta_.find(id);
-   if (it != meta_.end()) {
-      return it->second;
+const Prefab* Opus::prefab(Id prefab_id) const {
+   auto it = prefabs_.find(prefab_id);
+   if (it != prefabs_.end()) {
+      return &it->second;
    }
+   return nullptr;
+}
 
-   // doesn't exist, create it as a child of root_
-   op_meta newMeta;
-   auto result = meta_.emplace(id, newMeta);
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Registers a prefab template which can later be stamped out using
+///         instantiate().
+///
+/// \details The prefab is laid out and sorted once, here, so that
+///         instantiating it never needs to run op generators or sort
+///         children.  Registering a prefab with an Id that is already in use
+///         replaces the old template; existing instances are not affected.
+void Opus::prefab(Id prefab_id, Prefab prefab) {
+   prefab.seal_();
+   prefabs_[prefab_id] = std::move(prefab);
+}
 
-   op_meta rootMeta = meta_[Id()];
-   rootMeta.children.push_back(id);
-   rootMeta.children_dirty = true;
-   dirty_ = true;
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Creates a prefab template from an existing subtree.
+///
+/// \details The subtree's action objects are copied by value.  Descendant
+///         Ids are used as the prefab-relative Ids of the corresponding
+///         nodes.  If id does not refer to a live op, an empty prefab is
+///         returned.
+Prefab Opus::capture(Id id) const {
+   auto it = meta_.find(id);
+   if (it == meta_.end() || !it->second.op) {
+      return Prefab();
+   }
 
-   return result.first->second;
+   release_children_(it->second.parent);
+   release_children_(id);
+   const Op& op = *it->second.op;
+   Prefab prefab(op.data_.action, op.data_.remaining, op.data_.total);
+   prefab.nodes_.front().traits = op.data_.traits;
+   prefab.nodes_.front().watch = it->second.watch;
+   capture_(prefab, it->second, Id());
+   return prefab;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-Opus::op_meta& Opus::get_or_create_with_op_(Id id) {
-   auto it = meta_.find(id);
-   if (it != meta_.end()) {
-      op_meta& meta = it->second;
-      // ID exists; check to make sure handle is valid
-      if (meta.op) {
-         return meta;
-      } else {
-         // Op died; find parent and recreate it
-         op_meta& parent = get_or_create_with_op_(meta.parent);
-         auto& children = parent.op->data_.children;
-         children.push_back(op_gen_(id));
-         meta.op = static_cast<Handle<Op>>(children.back());
-         parent.children_dirty = true;
-         dirty_ = true;
-         return meta;
-      }
+/// \brief  Creates a copy of a registered prefab as a child of parent_id.
+///
+/// \details The root of the new subtree is assigned instance_id.  Other
+///         nodes are assigned Ids derived from instance_id and their
+///         prefab-relative Ids; see Prefab::id().  If instance_id already
+///         exists, it (and its descendants) will be erased first.
+///
+///         Each op in the new subtree is constructed directly from the
+///         prefab's copy of its action and timing values, and each child list
+///         is allocated once at its final size.  Only parent_id's children
+///         need to be re-sorted by the next clean_().
+///
+///         If the prefab is not registered, or a derived Id collides with an
+///         op outside of the old instance, an error is logged and nothing is
+///         changed: the existing instance_id op (if any) is returned as it
+///         was.  If there is no such op, there is nothing sensible to return,
+///         so this asserts, and returns the root op in release builds.
+///
+///         When recording, an instantiation is logged as the erase() and
+///         child() calls which would build the same tree, since the log
+///         cannot hold the prefab itself.
+Op& Opus::instantiate(Id prefab_id, Id parent_id, Id instance_id, I32 priority) {
+   assert((U64)instance_id);
+
+   auto pit = prefabs_.find(prefab_id);
+   bool ok = pit != prefabs_.end();
+   if (!ok) {
+      be_error() << "Prefab not found!"
+         & attr(ids::log_attr_op_id) << instance_id
+         & attr(ids::log_attr_parent_id) << parent_id
+         | default_log();
    } else {
-      // doesn't exist, create it as a child of root_
-      op_meta newMeta;
-      root_.data_.children.push_back(op_gen_(id));
-      newMeta.op = static_cast<Handle<Op>>(root_.data_.children.back());
-      auto result = meta_.emplace(id, newMeta);
+      // Ids of the old instance will be erased, so they can't collide
+      std::unordered_set<Id> old_ids;
+      auto it = meta_.find(instance_id);
+      if (it != meta_.end()) {
+         child_id_list stack { instance_id };
+         while (!stack.empty()) {
+            Id id = stack.back();
+            stack.pop_back();
+            auto it2 = meta_.find(id);
+            if (it2 != meta_.end()) {
+               old_ids.insert(id);
+               stack.insert(stack.end(), it2->second.children.begin(), it2->second.children.end());
+            }
+         }
+      }
 
-      op_meta rootMeta = meta_[Id()];
-      rootMeta.children.push_back(id);
-      rootMeta.children_dirty = true;
-      dirty_ = true;
+      for (const Prefab::node& node : pit->second.nodes_) {
+         Id id = Prefab::id(instance_id, node.id);
+         if (meta_.find(id) != meta_.end() && old_ids.count(id) == 0) {
+            be_error() << "Prefab instance Id collides with an existing op!"
+               & attr(ids::log_attr_op_id) << id
+               & attr(ids::log_attr_parent_id) << parent_id
+               | default_log();
+            ok = false;
+            break;
+         }
+      }
+   }
 
-      return result.first->second;
+   if (!ok) {
+      auto it = meta_.find(instance_id);
+      if (it != meta_.end() && it->second.op) {
+         return *it->second.op;
+      }
+      assert(false);
+      return root_;
    }
-}
 
-///////////////////////////////////////////////////////////////////////////////
-void Opus::clean_() {
-   if (dirty_) {
-      for (auto& p : meta_) {
-         clean_(p.second);
+   ++mutations_;
+   const Prefab& prefab = pit->second;
+   if (recorder_) {
+      // a log has no prefabs, so record the structure this call is
+      // equivalent to: erasing the old instance, then creating each node
+      OpusLogEvent event;
+      if (exists(instance_id)) {
+         event.type = OpusLogEventType::erase;
+         event.id = instance_id;
+         recorder_->record(event);
       }
-      dirty_ = false;
+      event.type = OpusLogEventType::child;
+      for (const Prefab::node& node : prefab.nodes_) {
+         bool root = !(U64)node.id;
+         event.id = Prefab::id(instance_id, node.id);
+         event.other_id = root ? parent_id : Prefab::id(instance_id, node.parent);
+         event.priority = root ? priority : node.priority;
+         recorder_->record(event);
+      }
+   }
+
+   if (exists(instance_id)) {
+      erase_(instance_id);
+   }
+
+   op_meta& parent = get_or_create_with_op_(parent_id);
+
+   auto& children = parent.op->data_.children;
+   children.push_back(build_(prefab, 0));
+   ++parent.op->data_.revision;
+   parent.children.push_back(instance_id);
+   parent.children_dirty = true;
+   dirty_ = true;
+   index_->valid = false;
+
+   Op& op = children.back();
+   register_(prefab, 0, op, instance_id, parent_id, priority);
+   return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Removes an op and its descendants from the Opus without
+///         destroying them.
+///
+/// \details The ops are moved, not copied, so their actions keep all of
+///         their state, and their Ids, priorities, divisors, frequencies,
+///         and time domain bindings are recorded so that adopt() can restore
+///         them, possibly in a different Opus.  Ops in the subtree which are
+///         waiting on a signal are returned to their parents first, since
+///         signals belong to a single Opus; the signal Ids they were waiting
+///         on (through wait() or wait_for()) are recorded instead.
+///         Publishing (see published()) is disabled for the extracted ops.
+///
+///         Like erase(), this must not be called from inside the action of
+///         an op in the subtree or any of its ancestors.
+OpSubtree Opus::extract(Id id) {
+   ++mutations_;
+   OpSubtree subtree;
+
+   auto it = meta_.find(id);
+   if (!(U64)id || it == meta_.end() || !it->second.op) {
+      return subtree;
+   }
+
+   extract_(subtree, it->second, id);
+
+   op_meta& meta = it->second;
+   op_meta& parent = get_or_create_(meta.parent);
+
+   auto it2 = std::find(parent.children.begin(), parent.children.end(), id);
+   if (it2 != parent.children.end()) {
+      parent.children.erase(it2);
+   }
+
+   Op* op = meta.op.get();
+   if (parent.op) {
+      release_children_(meta.parent);
+      auto& children = parent.op->data_.children;
+      auto it3 = std::find_if(children.begin(), children.end(), [=](const Op& child) { return &child == op; });
+      if (it3 != children.end()) {
+         subtree.op_ = std::move(*it3);
+         children.erase(it3);
+         ++parent.op->data_.revision;
+      } else {
+         be_error() << "Op not found in parent!"
+            & attr(ids::log_attr_op_id) << id
+            & attr(ids::log_attr_parent_id) << meta.parent
+            | default_log();
+
+         subtree.nodes_.clear();
+         return subtree;
+      }
+   }
+
+   for (auto& node : subtree.nodes_) {
+      meta_.erase(node.id);
+      published_.erase(node.id);
+   }
+   index_->valid = false;
+   metrics_->record_destroyed(subtree.nodes_.size());
+
+   return subtree;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Inserts a subtree created by extract() as a child of parent_id.
+///
+/// \details Every op keeps the Id it had when it was extracted; any existing
+///         ops with those Ids (and their descendants) are erased first.
+///         Time domain bindings are re-pointed at this Opus's domains with
+///         the same Ids, creating them if necessary.  Likewise, ops which
+///         were waiting on a signal when they were extracted wait on this
+///         Opus's signal with the same Id: ops parked by wait() are parked
+///         again at the start of the next tick, and ops blocked by
+///         wait_for() keep waiting.  Fires of the old Opus's signals while
+///         the subtree was in transit are not seen.
+Op& Opus::adopt(OpSubtree subtree, Id parent_id) {
+   ++mutations_;
+   assert(!subtree.empty());
+   if (subtree.empty()) {
+      return root_;
+   }
+
+   for (auto& node : subtree.nodes_) {
+      if (exists(node.id)) {
+         erase_(node.id);
+      }
+   }
+
+   Id id = subtree.id();
+   op_meta& parent = get_or_create_with_op_(parent_id);
+   parent.op->data_.children.push_back(std::move(subtree.op_));
+   ++parent.op->data_.revision;
+   parent.children.push_back(id);
+   parent.children_dirty = true;
+   dirty_ = true;
+   index_->valid = false;
+   metrics_->record_created(subtree.nodes_.size());
+
+   for (std::size_t i = 0; i < subtree.nodes_.size(); ++i) {
+      auto& node = subtree.nodes_[i];
+
+      op_meta meta;
+      meta.parent = i == 0 ? parent_id : node.parent;
+      meta.op = node.op;
+      meta.priority = node.priority;
+      meta.divisor = node.divisor;
+      meta.frequency = node.frequency;
+      meta.children_dirty = true;
+      meta_[node.id] = std::move(meta);
+
+      if (i > 0) {
+         // nodes are stored parents-first
+         meta_[node.parent].children.push_back(node.id);
+      }
+   }
+
+   for (auto& node : subtree.nodes_) {
+      if ((U64)node.domain) {
+         domain(node.id, node.domain);
+      }
+
+      if ((U64)node.watch) {
+         // keep the op::detail::WaitFor's state, but point it at this
+         // Opus's signal
+         op_meta& meta = meta_[node.id];
+         Op* op = meta.op.get();
+         detail::WaitFor* func = op ? inner_action_(*op).action->target<detail::WaitFor>() : nullptr;
+         if (func) {
+            signal(node.watch);
+            func->signal = signals_[node.watch];
+            meta.watch = node.watch;
+            if (func->armed && op->data_.remaining != 0) {
+               func->signal->watch_(node.id);
+            }
+         }
+      }
+
+      if ((U64)node.signal) {
+         wait(node.id, node.signal);
+      }
+   }
+
+   return *meta_[id].op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+OpusRecorder* Opus::recorder() const {
+   return recorder_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Starts recording structural changes and ticks to new_recorder,
+///         or stops recording if new_recorder is null.
+///
+/// \details child(), before(), after(), erase(), parent(Id, Id),
+///         priority(Id, I32), operator[] (when it creates or recreates an
+///         op), operator(), and fast_forward() are recorded, and
+///         instantiate() is recorded as the equivalent erase() and child()
+///         calls.  Other changes, such as adopt(), are not, so logs of an
+///         Opus which uses them will not replay exactly.  The recorder is not
+///         owned by the Opus.
+OpusRecorder* Opus::recorder(OpusRecorder* new_recorder) {
+   OpusRecorder* old_recorder = recorder_;
+   recorder_ = new_recorder;
+   return old_recorder;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Provides access to this Opus's scheduler telemetry.
+///
+/// \details Metrics are always collected; they can be read from any thread
+///         while the Opus is running, e.g. through
+///         service<op::Opus>().metrics().snapshot().
+OpusMetrics& Opus::metrics() {
+   return *metrics_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const OpusMetrics& Opus::metrics() const {
+   return *metrics_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Estimates the memory used by the whole Opus.
+///
+/// \details Includes every op (see memory(Id)), the Opus's hash table
+///         buckets, registered prefabs, time domains, and ops parked on
+///         signals.  Bucket slots beyond the number of ops, and parked op
+///         list capacity beyond the number of parked ops, count as unused.
+MemoryUsage Opus::memory() const {
+   MemoryUsage usage;
+   usage.used = sizeof(Opus);
+
+   for (auto& p : meta_) {
+      usage += memory_(p.second);
+   }
+
+   std::size_t buckets = meta_.bucket_count();
+   std::size_t used_buckets = std::min(buckets, meta_.size());
+   usage.used += used_buckets * sizeof(void*);
+   usage.unused += (buckets - used_buckets) * sizeof(void*);
+
+   for (auto& p : prefabs_) {
+      const Prefab::node_list& nodes = p.second.nodes_;
+      usage.used += nodes.size() * sizeof(Prefab::node);
+      usage.unused += (nodes.capacity() - nodes.size()) * sizeof(Prefab::node);
+      for (const Prefab::node& node : nodes) {
+         usage.used += detail::heap_size(node.action, node.traits);
+      }
+   }
+
+   usage.used += domains_.size() * (sizeof(domain_map::value_type) + sizeof(TimeDomain));
+
+   for (auto& p : signals_) {
+      const Signal::waiter_list& waiters = p.second->waiters_;
+      usage.used += sizeof(signal_map::value_type) + sizeof(Signal);
+      usage.used += waiters.size() * sizeof(Signal::waiter_list::value_type);
+      usage.unused += (waiters.capacity() - waiters.size()) * sizeof(Signal::waiter_list::value_type);
+      const Signal::watcher_list& watchers = p.second->watchers_;
+      usage.used += watchers.size() * sizeof(Signal::watcher_list::value_type);
+      usage.unused += (watchers.capacity() - watchers.size()) * sizeof(Signal::watcher_list::value_type);
+   }
+
+   for (auto& p : paused_) {
+      usage.used += sizeof(paused_map::value_type) + 2 * sizeof(void*);
+      usage.used += p.second.size() * sizeof(Signal::waiter_list::value_type);
+      usage.unused += (p.second.capacity() - p.second.size()) * sizeof(Signal::waiter_list::value_type);
+   }
+
+   usage.used += published_.size() * (sizeof(published_map::value_type) + 2 * sizeof(void*));
+
+   usage.used += index_->ids.capacity() * sizeof(Id);
+   usage.used += (index_->depths.capacity() + index_->ends.capacity()) * sizeof(U32);
+   usage.used += index_->positions.size() * (sizeof(std::pair<const Id, U32>) + 2 * sizeof(void*));
+   usage.used += index_->positions.bucket_count() * sizeof(void*);
+
+   usage.used += pending_waits_.size() * sizeof(wait_list::value_type);
+   usage.unused += (pending_waits_.capacity() - pending_waits_.size()) * sizeof(wait_list::value_type);
+
+   return usage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Estimates the memory used by a single op.
+///
+/// \details An op is charged for its bookkeeping entry, its list of child
+///         Ids, its child list (which holds the Op objects of its children),
+///         and the heap memory owned by its action (see
+///         op::detail::heap_size()).  Capacity reserved by either list but
+///         not in use is reported as unused.  Summing memory(Id) over every
+///         op counts each allocation once.
+MemoryUsage Opus::memory(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return memory_(it->second);
+   }
+   return MemoryUsage();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Estimates the memory used by an op and all of its descendants.
+MemoryUsage Opus::subtree_memory(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return subtree_memory_(it->second);
+   }
+   return MemoryUsage();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Releases capacity which is reserved but unused.
+///
+/// \details Every child list is reallocated at its current size, and the
+///         hash table is rehashed to the smallest bucket count that holds the
+///         current ops.  Useful after erasing a large number of ops.
+///
+///         Like adding children, this moves Op objects, so it must not be
+///         called from inside an op's action.  Ops keep their progress:
+///         containers refer to their children by index (op::detail::Queue)
+///         or by handle (op::detail::RoundRobin, op::detail::TypedSet), and
+///         the revision of every reallocated child list is incremented so
+///         that any per-child tables are rebuilt.
+void Opus::shrink_to_fit() {
+   for (auto& p : meta_) {
+      op_meta& meta = p.second;
+      meta.children.shrink_to_fit();
+
+      Op* op = meta.op.get();
+      if (op && op->data_.children.capacity() != op->data_.children.size()) {
+         op->data_.children.shrink_to_fit();
+         ++op->data_.revision;
+      }
+   }
+
+   meta_.rehash(0);
+
+   for (auto& p : prefabs_) {
+      p.second.nodes_.shrink_to_fit();
+   }
+
+   for (auto& p : signals_) {
+      p.second->waiters_.shrink_to_fit();
+      p.second->watchers_.shrink_to_fit();
+   }
+
+   for (auto& p : paused_) {
+      p.second.shrink_to_fit();
+   }
+
+   pending_waits_.shrink_to_fit();
+
+   // the index will be rebuilt at its new size the next time it is needed
+   index_.reset(new tree_index());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Opus::op_meta& Opus::get_or_create_(Id id) {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      return it->second;
+   }
+
+   // doesn't exist, create it as a child of root_
+   op_meta newMeta;
+   auto result = meta_.emplace(id, newMeta);
+
+   op_meta& rootMeta = meta_[Id()];
+   rootMeta.children.push_back(id);
+   rootMeta.children_dirty = true;
+   dirty_ = true;
+   index_->valid = false;
+
+   return result.first->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Opus::op_meta& Opus::get_or_create_with_op_(Id id) {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      op_meta& meta = it->second;
+      // ID exists; check to make sure handle is valid
+      if (meta.op) {
+         return meta;
+      } else {
+         // Op died; find parent and recreate it
+         op_meta& parent = get_or_create_with_op_(meta.parent);
+         auto& children = parent.op->data_.children;
+         children.push_back(op_gen_(id));
+         metrics_->record_created(1);
+         ++parent.op->data_.revision;
+         meta.op = static_cast<Handle<Op>>(children.back());
+         parent.children_dirty = true;
+         dirty_ = true;
+         return meta;
+      }
+   } else {
+      // doesn't exist, create it as a child of root_
+      op_meta newMeta;
+      root_.data_.children.push_back(op_gen_(id));
+      metrics_->record_created(1);
+      ++root_.data_.revision;
+      newMeta.op = static_cast<Handle<Op>>(root_.data_.children.back());
+      auto result = meta_.emplace(id, newMeta);
+
+      op_meta& rootMeta = meta_[Id()];
+      rootMeta.children.push_back(id);
+      rootMeta.children_dirty = true;
+      dirty_ = true;
+      index_->valid = false;
+
+      return result.first->second;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::clean_() {
+   if (dirty_) {
+      auto start = std::chrono::steady_clock::now();
+      clean_lists_ = 0;
+      clean_children_ = 0;
+
+      for (auto& p : meta_) {
+         clean_(p.second);
+      }
+      dirty_ = false;
+
+      U64 ns = (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      metrics_->record_clean(ns, clean_lists_, clean_children_);
    }
 }
 
@@ -406,7 +1501,7 @@ void Opus::clean_(op_meta& meta) {
          if (it != meta_.end()) {
             op_meta& child = it->second;
             Op* child_op = child.op.get();
-            if (child_op) {
+            if (child_op && !(U64)child.signal) {
                // swap *op_it with *child_op
                using std::swap;
                swap(*op_it, *child_op);
@@ -415,9 +1510,796 @@ void Opus::clean_(op_meta& meta) {
          }
       }
       
+      ++op->data_.revision;
+      stagger_(meta);
+
+      ++clean_lists_;
+      clean_children_ += kids.size();
    }
 
    meta.children_dirty = false;
+   index_->valid = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the hierarchy index, rebuilding it first if the
+///         hierarchy has changed since it was last built.
+///
+/// \details Const queries may be made concurrently (e.g. from the workers of
+///         a ParallelFor or ParallelSet), so the rebuild is done under the
+///         index's mutex, and valid is only set once the rebuilt index is
+///         complete.  The hierarchy itself must not be modified while other
+///         threads are querying it.
+const Opus::tree_index& Opus::tree_index_() const {
+   tree_index& index = *index_;
+   if (index.valid.load(std::memory_order_acquire)) {
+      return index;
+   }
+
+   std::lock_guard<std::mutex> lock(index.mutex);
+   if (index.valid.load(std::memory_order_relaxed)) {
+      return index;
+   }
+
+   index.ids.clear();
+   index.depths.clear();
+   index.ends.clear();
+   index.positions.clear();
+   index.ids.reserve(meta_.size());
+   index.depths.reserve(meta_.size());
+   index.ends.reserve(meta_.size());
+   index.positions.reserve(meta_.size());
+
+   struct frame {
+      const op_meta* meta;
+      U32 position;
+      std::size_t next_child;
+   };
+   std::vector<frame> stack;
+
+   auto visit = [&](Id id, const op_meta& meta) {
+      U32 position = (U32)index.ids.size();
+      index.ids.push_back(id);
+      index.depths.push_back((U32)stack.size());
+      index.ends.push_back(position + 1);
+      index.positions[id] = position;
+      stack.push_back(frame { &meta, position, 0 });
+   };
+
+   auto rit = meta_.find(Id());
+   if (rit != meta_.end()) {
+      visit(Id(), rit->second);
+   }
+
+   while (!stack.empty()) {
+      frame& f = stack.back();
+      if (f.next_child < f.meta->children.size()) {
+         Id child_id = f.meta->children[f.next_child++];
+         auto it = meta_.find(child_id);
+         if (it != meta_.end()) {
+            visit(child_id, it->second);
+         }
+      } else {
+         index.ends[f.position] = (U32)index.ids.size();
+         stack.pop_back();
+      }
+   }
+
+   index.valid.store(true, std::memory_order_release);
+   return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Makes the state written during this tick visible to readers
+///         during the next one.
+void Opus::publish_() {
+   for (auto& p : published_) {
+      published_op& entry = p.second;
+      Op* op = entry.op.get();
+      if (!op) {
+         // op was recreated (see get_or_create_with_op_); follow it
+         auto it = meta_.find(p.first);
+         if (it == meta_.end() || !it->second.op) {
+            continue;
+         }
+         entry.op = it->second.op;
+         op = entry.op.get();
+      }
+      entry.remaining = op->data_.remaining;
+      entry.total = op->data_.total;
+   }
+
+   for (auto& p : buffered_states_) {
+      p.second->publish_();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::extract_(OpSubtree& subtree, op_meta& meta, Id id) {
+   // signals belong to this Opus; record which ones the op was waiting on
+   // so that adopt() can wait on the adopting Opus's signals instead
+   Id signal = meta.paused ? Id() : meta.signal;
+   for (auto it = pending_waits_.begin(); it != pending_waits_.end(); ) {
+      if (it->id == id) {
+         signal = it->signal;
+         it = pending_waits_.erase(it);
+      } else {
+         ++it;
+      }
+   }
+
+   Id watch = meta.watch;
+   unpark_(meta);
+   unwatch_(meta, id);
+   subtree.nodes_.push_back(OpSubtree::node { id, meta.parent, meta.priority, meta.divisor, meta.frequency, meta.domain, meta.op, signal, watch });
+
+   for (Id child_id : meta.children) {
+      auto it = meta_.find(child_id);
+      if (it != meta_.end()) {
+         extract_(subtree, it->second, child_id);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns an op which is waiting on a signal to its parent
+///         immediately, without waiting for the signal to fire.
+void Opus::unpark_(op_meta& meta) {
+   if (!(U64)meta.signal) {
+      return;
+   }
+
+   Op* op = meta.op.get();
+   Signal::waiter_list* waiters = parked_list_(meta);
+   meta.signal = Id();
+   meta.paused = false;
+   if (!op || !waiters) {
+      return;
+   }
+
+   auto it = std::find_if(waiters->begin(), waiters->end(), [=](const std::pair<Id, Op>& waiter) { return &waiter.second == op; });
+   if (it != waiters->end()) {
+      op_meta& parent = get_or_create_with_op_(meta.parent);
+      parent.op->data_.children.push_back(std::move(it->second));
+      waiters->erase(it);
+      ++parent.op->data_.revision;
+      parent.children_dirty = true;
+      dirty_ = true;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Has an op's action return any state it holds on behalf of its
+///         children (see op::detail::TypedSet) to them.
+///
+/// \details Must be called before one of the op's children is moved out of
+///         its child list or has its action wrapped or unwrapped, and before
+///         its children's actions are copied.  Does not change anything
+///         observable about the op, so it may be called from const methods.
+void Opus::release_children_(Id id) const {
+   auto it = meta_.find(id);
+   if (it != meta_.end()) {
+      Op* op = it->second.op.get();
+      if (op) {
+         detail::release_children(op->data_.action, op->data_.traits, op->data_);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the list holding a parked op: the wait list of the
+///         signal it is waiting on, or the paused list of its time domain.
+Signal::waiter_list* Opus::parked_list_(const op_meta& meta) {
+   if (meta.paused) {
+      auto it = paused_.find(meta.signal);
+      return it != paused_.end() ? &it->second : nullptr;
+   }
+
+   auto it = signals_.find(meta.signal);
+   return it != signals_.end() ? &it->second->waiters_ : nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::park_(Id id, Id signal_id) {
+   auto it = meta_.find(id);
+   if (it == meta_.end() || (it->second.signal == signal_id && !it->second.paused)) {
+      return;
+   }
+
+   op_meta& meta = it->second;
+   Op* op = meta.op.get();
+   if (!op) {
+      return;
+   }
+
+   Signal& new_signal = signal(signal_id);
+
+   if ((U64)meta.signal) {
+      // already waiting on a different signal (or paused); move it to the
+      // new wait list
+      Signal::waiter_list* waiters = parked_list_(meta);
+      if (!waiters) {
+         return;
+      }
+      auto it2 = std::find_if(waiters->begin(), waiters->end(), [=](const std::pair<Id, Op>& waiter) { return &waiter.second == op; });
+      if (it2 != waiters->end()) {
+         new_signal.waiters_.push_back(std::make_pair(id, std::move(it2->second)));
+         waiters->erase(it2);
+         meta.signal = signal_id;
+         meta.paused = false;
+      }
+      return;
+   }
+
+   op_meta& parent = get_or_create_(meta.parent);
+   if (!parent.op) {
+      return;
+   }
+
+   release_children_(meta.parent);
+   auto& children = parent.op->data_.children;
+   auto it2 = std::find_if(children.begin(), children.end(), [=](const Op& child) { return &child == op; });
+   if (it2 != children.end()) {
+      new_signal.waiters_.push_back(std::make_pair(id, std::move(*it2)));
+      children.erase(it2);
+      ++parent.op->data_.revision;
+      meta.signal = signal_id;
+   } else {
+      be_error() << "Op not found in parent!"
+         & attr(ids::log_attr_op_id) << id
+         & attr(ids::log_attr_parent_id) << meta.parent
+         | default_log();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Installs an op::detail::WaitFor for signal_id as an op's action,
+///         inside any domain or schedule wrappers.
+void Opus::watch_(op_meta& meta, Id id, Id signal_id) {
+   unwatch_(meta, id);
+   Op* op = meta.op.get();
+   if (!op) {
+      return;
+   }
+
+   signal(signal_id);
+   release_children_(meta.parent);
+   action_slot slot = inner_action_(*op);
+   *slot.action = detail::WaitFor(signals_[signal_id], id);
+   *slot.traits = action_traits<detail::WaitFor>();
+   op->data_.remaining = -1;
+   ++op->data_.revision;
+   meta.watch = signal_id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Removes an op's registration (if any) from the signal it was
+///         waiting for in place.
+void Opus::unwatch_(op_meta& meta, Id id) {
+   if (!(U64)meta.watch) {
+      return;
+   }
+
+   auto sit = signals_.find(meta.watch);
+   if (sit != signals_.end()) {
+      sit->second->unwatch_(id);
+   }
+   meta.watch = Id();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Wakes the waiters of every fired signal, then parks ops which
+///         have requested to wait since the last tick.
+///
+/// \details Fired signals are drained first, so an op which called wait()
+///         after a signal fired is not woken by that fire.  Each fire is
+///         counted, so a fire which lands after wait() was called but before
+///         the op is parked still wakes it (by not parking it).  Ops waiting
+///         in place (see wait_for()) are only woken by fires after they
+///         registered, and have their remaining() time set to 0.
+void Opus::wake_() {
+   Signal* s = fired_->exchange(nullptr, std::memory_order_acquire);
+   while (s) {
+      Signal* next = s->next_;
+      s->queued_.store(false);
+      s->wakes_.fetch_add(1, std::memory_order_relaxed);
+      U64 fires = s->fires_.load();
+
+      Signal::waiter_list waiters;
+      std::swap(waiters, s->waiters_);
+      for (auto& waiter : waiters) {
+         auto it = meta_.find(waiter.first);
+         if (it == meta_.end()) {
+            continue;
+         }
+
+         op_meta& meta = it->second;
+         meta.signal = Id();
+
+         op_meta& parent = get_or_create_with_op_(meta.parent);
+         parent.op->data_.children.push_back(std::move(waiter.second));
+         ++parent.op->data_.revision;
+         parent.children_dirty = true;
+         dirty_ = true;
+      }
+
+      std::lock_guard<std::mutex> lock(s->watchers_mutex_);
+      auto& watchers = s->watchers_;
+      for (std::size_t i = 0; i < watchers.size(); ) {
+         if (watchers[i].second >= fires) {
+            ++i;
+            continue;
+         }
+
+         Id id = watchers[i].first;
+         watchers[i] = watchers.back();
+         watchers.pop_back();
+
+         auto it = meta_.find(id);
+         if (it == meta_.end() || !it->second.op) {
+            continue;
+         }
+
+         op_meta& meta = it->second;
+         auto sit = signals_.find(meta.watch);
+         if (sit != signals_.end() && sit->second.get() == s) {
+            Op& op = *meta.op;
+            op.data_.remaining = 0;
+            ++op.data_.revision;
+         }
+      }
+
+      s = next;
+   }
+
+   if (!pending_waits_.empty()) {
+      wait_list waits;
+      std::swap(waits, pending_waits_);
+      for (auto& w : waits) {
+         auto sit = signals_.find(w.signal);
+         if (sit != signals_.end() && sit->second->fires_.load() != w.fires) {
+            // fired since wait() was called
+            auto it = meta_.find(w.id);
+            if (it != meta_.end()) {
+               unpark_(it->second);
+            }
+            continue;
+         }
+         park_(w.id, w.signal);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Calculates the factor, dt and clock of every time domain, and
+///         parks or returns the ops bound to domains whose factor has become
+///         0 or non-zero.
+///
+/// \details Finding the ops to park means scanning every op, but this only
+///         happens on the tick a domain is paused.
+void Opus::resolve_domains_(F64 dt) {
+   for (auto& p : domains_) {
+      TimeDomain& d = *p.second;
+      F64 old_factor = d.factor;
+      if (d.paused) {
+         d.factor = 0;
+      } else if (d.scale_func) {
+         d.factor = d.scale_func();
+      } else {
+         d.factor = d.scale;
+      }
+      d.dt = dt * d.factor;
+      d.clock += d.dt;
+
+      if (d.factor == 0 && old_factor != 0) {
+         for (auto& m : meta_) {
+            if (m.second.domain == p.first) {
+               pause_(m.first, m.second);
+            }
+         }
+      } else if (d.factor != 0 && old_factor == 0) {
+         resume_(p.first);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the domain bound to the nearest ancestor of an op, or
+///         Id() if there is none.
+Id Opus::enclosing_domain_(Id id) const {
+   auto it = meta_.find(id);
+   while (it != meta_.end() && (U64)it->first) {
+      it = meta_.find(it->second.parent);
+      if (it != meta_.end() && (U64)it->second.domain) {
+         return it->second.domain;
+      }
+   }
+   return Id();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns true if any descendant of an op is bound to a domain.
+bool Opus::bound_below_(Id id) const {
+   if (domains_.empty()) {
+      return false;
+   }
+
+   auto it = meta_.find(id);
+   if (it == meta_.end()) {
+      return false;
+   }
+
+   child_id_list stack(it->second.children);
+   while (!stack.empty()) {
+      auto it2 = meta_.find(stack.back());
+      stack.pop_back();
+      if (it2 != meta_.end()) {
+         if ((U64)it2->second.domain) {
+            return true;
+         }
+         stack.insert(stack.end(), it2->second.children.begin(), it2->second.children.end());
+      }
+   }
+   return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Unbinds any ops in a subtree which has just been moved under an
+///         op bound to a domain, since domains can't be nested.
+void Opus::unnest_domains_(Id id) {
+   if (domains_.empty() || !(U64)enclosing_domain_(id)) {
+      return;
+   }
+
+   child_id_list stack { id };
+   while (!stack.empty()) {
+      Id next = stack.back();
+      stack.pop_back();
+      auto it = meta_.find(next);
+      if (it == meta_.end()) {
+         continue;
+      }
+
+      if ((U64)it->second.domain) {
+         be_error() << "Time domains cannot be nested; unbinding op!"
+            & attr(ids::log_attr_op_id) << next
+            & attr(ids::log_attr_parent_id) << it->second.parent
+            | default_log();
+         domain(next, Id());
+         continue;
+      }
+
+      stack.insert(stack.end(), it->second.children.begin(), it->second.children.end());
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Moves an op bound to a paused domain out of its parent's child
+///         list, unless it is already parked or its parent is a queue.
+void Opus::pause_(Id id, op_meta& meta) {
+   Op* op = meta.op.get();
+   if (!(U64)id || !op || (U64)meta.signal) {
+      return;
+   }
+
+   auto pit = meta_.find(meta.parent);
+   if (pit == meta_.end() || !pit->second.op || tracks_positions_(*pit->second.op)) {
+      return;
+   }
+
+   op_meta& parent = pit->second;
+   release_children_(meta.parent);
+   auto& children = parent.op->data_.children;
+   auto it = std::find_if(children.begin(), children.end(), [=](const Op& child) { return &child == op; });
+   if (it != children.end()) {
+      paused_[meta.domain].push_back(std::make_pair(id, std::move(*it)));
+      children.erase(it);
+      ++parent.op->data_.revision;
+      meta.signal = meta.domain;
+      meta.paused = true;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the ops parked by pause_() to their parents.
+void Opus::resume_(Id domain_id) {
+   auto it = paused_.find(domain_id);
+   if (it == paused_.end() || it->second.empty()) {
+      return;
+   }
+
+   Signal::waiter_list ops;
+   std::swap(ops, it->second);
+   for (auto& p : ops) {
+      auto mit = meta_.find(p.first);
+      if (mit == meta_.end()) {
+         continue;
+      }
+
+      op_meta& meta = mit->second;
+      meta.signal = Id();
+      meta.paused = false;
+
+      op_meta& parent = get_or_create_with_op_(meta.parent);
+      parent.op->data_.children.push_back(std::move(p.second));
+      ++parent.op->data_.revision;
+      parent.children_dirty = true;
+      dirty_ = true;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns true if an op's action steps through its children by
+///         position (see op::detail::Queue), so they must not be removed
+///         while it runs.
+bool Opus::tracks_positions_(Op& op) {
+   return inner_action_(op).action->target<detail::Queue>() != nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the op's action and traits, or if the op is bound to a
+///         time domain, the action and traits inside the
+///         op::detail::DomainBound wrapper.
+///
+/// \details Domain bindings are always the outermost wrapper, so that other
+///         wrappers see scaled dt values.
+Opus::action_slot Opus::unbound_action_(Op& op) {
+   action_slot slot { &op.data_.action, &op.data_.traits };
+   domain_func* func = op.data_.action.target<domain_func>();
+   if (func) {
+      slot.action = &static_cast<OpData::action_func&>(*func);
+      slot.traits = &func->inner_traits;
+   }
+   return slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the op's action and traits inside any domain and
+///         schedule wrappers.
+Opus::action_slot Opus::inner_action_(Op& op) {
+   action_slot slot = unbound_action_(op);
+   scheduled_func* func = slot.action->target<scheduled_func>();
+   if (func) {
+      slot.action = &static_cast<OpData::action_func&>(*func);
+      slot.traits = &func->inner_traits;
+   }
+   return slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Wraps or unwraps an op's action in op::detail::Scheduled
+///         according to its divisor and frequency.
+Opus::scheduled_func* Opus::schedule_(op_meta& meta) {
+   Op* op = meta.op.get();
+   if (!op) {
+      return nullptr;
+   }
+
+   action_slot slot = unbound_action_(*op);
+   auto& action = *slot.action;
+   scheduled_func* func = action.target<scheduled_func>();
+
+   if (meta.divisor <= 1 && meta.frequency <= 0) {
+      if (func) {
+         release_children_(meta.parent);
+         const ActionTraits* inner_traits = func->inner_traits;
+         OpData::action_func inner = std::move(static_cast<OpData::action_func&>(*func));
+         action = std::move(inner);
+         *slot.traits = inner_traits;
+         ++op->data_.revision;
+      }
+      return nullptr;
+   }
+
+   if (!func) {
+      release_children_(meta.parent);
+      meta.staggered = false;
+      const ActionTraits* inner_traits = *slot.traits;
+      action = scheduled_func(std::move(action));
+      func = action.target<scheduled_func>();
+      func->inner_traits = inner_traits;
+      *slot.traits = action_traits<scheduled_func>();
+      ++op->data_.revision;
+   }
+
+   func->divisor = meta.divisor;
+   func->interval = meta.frequency > 0 ? 1 / meta.frequency : 0;
+   return func;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Spreads the phases of scheduled siblings evenly, so that children
+///         with the same divisor or frequency don't all run on the same tick.
+///
+/// \details Only children which have not been given a phase yet (because
+///         they were just scheduled, rescheduled, or reparented) are
+///         assigned one; each is placed in the least occupied phase of its
+///         group.  Children which already have a phase keep their countdown,
+///         so frequent re-sorts (e.g. siblings being spawned every tick) never
+///         hold them back.
+void Opus::stagger_(op_meta& meta) {
+   struct group {
+      U32 divisor;
+      F64 frequency;
+      U32 size;
+      std::vector<U32> load;
+   };
+   std::vector<group> groups;
+
+   auto find_group = [&groups](const op_meta& child) -> group& {
+      for (group& g : groups) {
+         if (g.divisor == child.divisor && g.frequency == child.frequency) {
+            return g;
+         }
+      }
+      groups.push_back(group { child.divisor, child.frequency, 0, std::vector<U32>() });
+      return groups.back();
+   };
+
+   auto is_scheduled = [](const op_meta& child) {
+      return child.divisor > 1 || child.frequency > 0;
+   };
+
+   bool unstaggered = false;
+   for (Id id : meta.children) {
+      auto it = meta_.find(id);
+      if (it != meta_.end() && is_scheduled(it->second)) {
+         op_meta& child = it->second;
+         if (schedule_(child)) {
+            ++find_group(child).size;
+            unstaggered = unstaggered || !child.staggered;
+         }
+      }
+   }
+
+   if (!unstaggered) {
+      return;
+   }
+
+   // phases are countdown values for divisors, or fractions of the period
+   // for frequencies
+   auto bucket_count = [](const group& g) -> U32 {
+      return g.divisor > 1 ? g.divisor : g.size;
+   };
+
+   for (group& g : groups) {
+      g.load.assign(bucket_count(g), 0);
+   }
+
+   for (Id id : meta.children) {
+      auto it = meta_.find(id);
+      if (it != meta_.end() && is_scheduled(it->second) && it->second.staggered) {
+         op_meta& child = it->second;
+         scheduled_func* func = schedule_(child);
+         if (func) {
+            group& g = find_group(child);
+            U32 buckets = (U32)g.load.size();
+            U32 bucket;
+            if (g.divisor > 1) {
+               bucket = func->countdown % buckets;
+            } else {
+               bucket = std::min(buckets - 1, (U32)(func->elapsed / func->interval * buckets));
+            }
+            ++g.load[bucket];
+         }
+      }
+   }
+
+   for (Id id : meta.children) {
+      auto it = meta_.find(id);
+      if (it != meta_.end() && is_scheduled(it->second) && !it->second.staggered) {
+         op_meta& child = it->second;
+         scheduled_func* func = schedule_(child);
+         if (func) {
+            group& g = find_group(child);
+            auto least = std::min_element(g.load.begin(), g.load.end());
+            U32 bucket = (U32)(least - g.load.begin());
+            ++*least;
+
+            if (g.divisor > 1) {
+               func->countdown = bucket;
+               func->elapsed = 0;
+            } else {
+               func->countdown = 0;
+               func->elapsed = func->interval * bucket / (U32)g.load.size();
+            }
+         }
+         child.staggered = true;
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::capture_(Prefab& prefab, const op_meta& meta, Id relative_id) const {
+   for (Id id : meta.children) {
+      auto it = meta_.find(id);
+      if (it != meta_.end() && it->second.op) {
+         const op_meta& child = it->second;
+         release_children_(id);
+         const Op& op = *child.op;
+         prefab.child(relative_id, id, child.priority, op.data_.action, op.data_.remaining, op.data_.total);
+         prefab.nodes_.back().traits = op.data_.traits;
+         prefab.nodes_.back().watch = child.watch;
+         capture_(prefab, child, id);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Op Opus::build_(const Prefab& prefab, std::size_t index) {
+   const Prefab::node& node = prefab.nodes_[index];
+
+   Op op;
+   op.data_.remaining = node.remaining;
+   op.data_.total = node.total;
+   op.data_.action = node.action;
+   op.data_.traits = node.traits;
+   metrics_->record_created(1);
+
+   auto& children = op.data_.children;
+   children.reserve(node.child_count);
+   for (std::size_t i = node.first_child, end = i + node.child_count; i < end; ++i) {
+      children.push_back(build_(prefab, i));
+   }
+
+   return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Opus::register_(const Prefab& prefab, std::size_t index, Op& op, Id instance_id, Id parent_id, I32 priority) {
+   const Prefab::node& node = prefab.nodes_[index];
+   Id id = Prefab::id(instance_id, node.id);
+
+   op_meta meta;
+   meta.parent = parent_id;
+   meta.op = static_cast<Handle<Op>>(op);
+   meta.priority = priority;
+   meta.children.reserve(node.child_count);
+
+   for (std::size_t i = 0; i < node.child_count; ++i) {
+      const Prefab::node& child = prefab.nodes_[node.first_child + i];
+      meta.children.push_back(Prefab::id(instance_id, child.id));
+      register_(prefab, node.first_child + i, op.data_.children[i], instance_id, id, child.priority);
+   }
+
+   op_meta& registered = meta_[id];
+   registered = std::move(meta);
+   if ((U64)node.watch) {
+      // the copied op::detail::WaitFor is bound to the captured op's Id
+      watch_(registered, id, node.watch);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+MemoryUsage Opus::memory_(const op_meta& meta) const {
+   // approximate size of an unordered_map node: the entry itself, plus the
+   // next pointer and cached hash
+   MemoryUsage usage;
+   usage.used = sizeof(opus_map::value_type) + 2 * sizeof(void*);
+   usage.used += meta.children.size() * sizeof(Id);
+   usage.unused += (meta.children.capacity() - meta.children.size()) * sizeof(Id);
+
+   const Op* op = meta.op.get();
+   if (op) {
+      const auto& children = op->data_.children;
+      usage.used += children.size() * sizeof(Op);
+      usage.unused += (children.capacity() - children.size()) * sizeof(Op);
+      usage.used += detail::heap_size(op->data_.action, op->data_.traits);
+   }
+
+   return usage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+MemoryUsage Opus::subtree_memory_(const op_meta& meta) const {
+   MemoryUsage usage = memory_(meta);
+   for (Id id : meta.children) {
+      auto it = meta_.find(id);
+      if (it != meta_.end()) {
+         usage += subtree_memory_(it->second);
+      }
+   }
+   return usage;
 }
 
 } // be::op
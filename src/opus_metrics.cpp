@@ -0,0 +1,156 @@
+#include "pch.hpp"
+#include "opus_metrics.hpp"
+
+namespace be {
+namespace op {
+namespace {
+
+template <typename H>
+void record(H& histogram, U64 value) {
+   std::size_t bucket = 0;
+   while (value != 0 && bucket + 1 < histogram.size()) {
+      value >>= 1;
+      ++bucket;
+   }
+   histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void record_max(std::atomic<U64>& max, U64 value) {
+   U64 cur = max.load(std::memory_order_relaxed);
+   while (cur < value && !max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) { }
+}
+
+U64 load(const std::atomic<U64>& value) {
+   return value.load(std::memory_order_relaxed);
+}
+
+U64 exchange(std::atomic<U64>& value) {
+   return value.exchange(0, std::memory_order_relaxed);
+}
+
+template <typename H, typename Read>
+void read_histogram(H& histogram, MetricHistogram& out, Read read) {
+   for (std::size_t i = 0; i < out.size(); ++i) {
+      out[i] = read(histogram[i]);
+   }
+}
+
+} // be::op::()
+
+///////////////////////////////////////////////////////////////////////////////
+OpusMetrics::OpusMetrics()
+   : ticks_(0),
+     tick_ns_total_(0),
+     tick_ns_max_(0),
+     jitter_ns_max_(0),
+     ops_invoked_(0),
+     cleans_(0),
+     parents_sorted_(0),
+     children_sorted_(0),
+     clean_ns_total_(0),
+     clean_ns_max_(0),
+     mutations_(0),
+     ops_created_(0),
+     ops_destroyed_(0),
+     last_tick_ns_(0)
+{
+   for (std::size_t i = 0; i < tick_ns_.size(); ++i) {
+      tick_ns_[i].store(0, std::memory_order_relaxed);
+      jitter_ns_[i].store(0, std::memory_order_relaxed);
+      ops_per_tick_[i].store(0, std::memory_order_relaxed);
+      mutations_per_tick_[i].store(0, std::memory_order_relaxed);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Copies every metric into a snapshot, using read (load or
+///         exchange) to read each value.
+template <typename M, typename Read>
+void OpusMetrics::read_(M& m, OpusMetricsSnapshot& s, Read read) {
+   s.ticks = read(m.ticks_);
+   s.tick_ns_total = read(m.tick_ns_total_);
+   s.tick_ns_max = read(m.tick_ns_max_);
+   read_histogram(m.tick_ns_, s.tick_ns, read);
+   s.jitter_ns_max = read(m.jitter_ns_max_);
+   read_histogram(m.jitter_ns_, s.jitter_ns, read);
+   s.ops_invoked = read(m.ops_invoked_);
+   read_histogram(m.ops_per_tick_, s.ops_per_tick, read);
+   s.cleans = read(m.cleans_);
+   s.parents_sorted = read(m.parents_sorted_);
+   s.children_sorted = read(m.children_sorted_);
+   s.clean_ns_total = read(m.clean_ns_total_);
+   s.clean_ns_max = read(m.clean_ns_max_);
+   s.mutations = read(m.mutations_);
+   read_histogram(m.mutations_per_tick_, s.mutations_per_tick, read);
+   s.ops_created = read(m.ops_created_);
+   s.ops_destroyed = read(m.ops_destroyed_);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Reads the current values of every metric.
+OpusMetricsSnapshot OpusMetrics::snapshot() const {
+   OpusMetricsSnapshot s;
+   read_(*this, s, load);
+   return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Reads the current values of every metric and resets them to 0,
+///         starting a new interval.
+///
+/// \details Each value is exchanged individually, so no counts are lost,
+///         even if the Opus is running concurrently.
+OpusMetricsSnapshot OpusMetrics::take() {
+   OpusMetricsSnapshot s;
+   read_(*this, s, exchange);
+   return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Records the duration of a tick, the number of ops invoked during
+///         it, and the number of structural mutations made since the
+///         previous tick.
+///
+/// \details Jitter is the absolute difference between this tick's duration
+///         and the previous tick's.
+void OpusMetrics::record_tick(U64 ns, U64 ops_invoked, U64 mutations) {
+   ticks_.fetch_add(1, std::memory_order_relaxed);
+   tick_ns_total_.fetch_add(ns, std::memory_order_relaxed);
+   record_max(tick_ns_max_, ns);
+   record(tick_ns_, ns);
+
+   if (last_tick_ns_ != 0) {
+      U64 jitter = ns > last_tick_ns_ ? ns - last_tick_ns_ : last_tick_ns_ - ns;
+      record_max(jitter_ns_max_, jitter);
+      record(jitter_ns_, jitter);
+   }
+   last_tick_ns_ = ns;
+
+   ops_invoked_.fetch_add(ops_invoked, std::memory_order_relaxed);
+   record(ops_per_tick_, ops_invoked);
+
+   mutations_.fetch_add(mutations, std::memory_order_relaxed);
+   record(mutations_per_tick_, mutations);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusMetrics::record_clean(U64 ns, U64 parents_sorted, U64 children_sorted) {
+   cleans_.fetch_add(1, std::memory_order_relaxed);
+   parents_sorted_.fetch_add(parents_sorted, std::memory_order_relaxed);
+   children_sorted_.fetch_add(children_sorted, std::memory_order_relaxed);
+   clean_ns_total_.fetch_add(ns, std::memory_order_relaxed);
+   record_max(clean_ns_max_, ns);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusMetrics::record_created(U64 ops) {
+   ops_created_.fetch_add(ops, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusMetrics::record_destroyed(U64 ops) {
+   ops_destroyed_.fetch_add(ops, std::memory_order_relaxed);
+}
+
+} // be::op
+} // be
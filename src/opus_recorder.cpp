@@ -0,0 +1,192 @@
+#include "pch.hpp"
+#include "opus_recorder.hpp"
+#include "opus.hpp"
+#include <cstring>
+
+namespace be {
+namespace op {
+namespace {
+
+const char log_magic[4] = { 'B', 'E', 'O', 'P' };
+const U32 log_version = 1;
+
+template <typename T>
+void write(std::ostream& os, T value) {
+   char buf[sizeof(T)];
+   std::memcpy(buf, &value, sizeof(T));
+   os.write(buf, sizeof(T));
+}
+
+template <typename T>
+bool read(std::istream& is, T& value) {
+   char buf[sizeof(T)];
+   if (!is.read(buf, sizeof(T))) {
+      return false;
+   }
+   std::memcpy(&value, buf, sizeof(T));
+   return true;
+}
+
+bool read(std::istream& is, Id& id) {
+   U64 value;
+   if (!read(is, value)) {
+      return false;
+   }
+   id = Id(value);
+   return true;
+}
+
+} // be::op::()
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Makes the same call on opus that this event was recorded from.
+void OpusLogEvent::apply(Opus& opus) const {
+   switch (type) {
+      case OpusLogEventType::tick:
+         opus(dt);
+         break;
+      case OpusLogEventType::fast_forward:
+         opus.fast_forward(dt, step_size);
+         break;
+      case OpusLogEventType::create:
+         opus[id];
+         break;
+      case OpusLogEventType::child:
+         opus.child(other_id, id, priority);
+         break;
+      case OpusLogEventType::erase:
+         opus.erase(id);
+         break;
+      case OpusLogEventType::parent:
+         opus.parent(id, other_id);
+         break;
+      case OpusLogEventType::priority:
+         opus.priority(id, priority);
+         break;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+OpusRecorder::OpusRecorder(std::ostream& os)
+   : os_(&os),
+     events_(0)
+{
+   os.write(log_magic, sizeof(log_magic));
+   write(os, log_version);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusRecorder::record(const OpusLogEvent& event) {
+   std::ostream& os = *os_;
+   write(os, (U8)event.type);
+
+   switch (event.type) {
+      case OpusLogEventType::tick:
+         write(os, event.dt);
+         break;
+      case OpusLogEventType::fast_forward:
+         write(os, event.dt);
+         write(os, event.step_size);
+         break;
+      case OpusLogEventType::create:
+      case OpusLogEventType::erase:
+         write(os, (U64)event.id);
+         break;
+      case OpusLogEventType::child:
+         write(os, (U64)event.id);
+         write(os, (U64)event.other_id);
+         write(os, event.priority);
+         break;
+      case OpusLogEventType::parent:
+         write(os, (U64)event.id);
+         write(os, (U64)event.other_id);
+         break;
+      case OpusLogEventType::priority:
+         write(os, (U64)event.id);
+         write(os, event.priority);
+         break;
+   }
+
+   ++events_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+U64 OpusRecorder::events() const {
+   return events_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Prepares to read a log written by OpusRecorder.
+///
+/// \details If the stream does not start with a log header of a supported
+///         version, valid() will return false and next() will not return
+///         any events.
+OpusLogReader::OpusLogReader(std::istream& is)
+   : is_(&is),
+     valid_(false)
+{
+   char magic[sizeof(log_magic)];
+   U32 version;
+   if (is.read(magic, sizeof(magic)) && read(is, version)) {
+      valid_ = std::memcmp(magic, log_magic, sizeof(magic)) == 0 && version == log_version;
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool OpusLogReader::valid() const {
+   return valid_;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Reads the next event from the log.
+///
+/// \return false if the end of the log has been reached, or the log is
+///         truncated or corrupt.
+bool OpusLogReader::next(OpusLogEvent& event) {
+   if (!valid_) {
+      return false;
+   }
+
+   std::istream& is = *is_;
+   U8 type;
+   if (!read(is, type)) {
+      return false;
+   }
+
+   event = OpusLogEvent();
+   event.type = (OpusLogEventType)type;
+
+   bool ok;
+   switch (event.type) {
+      case OpusLogEventType::tick:
+         ok = read(is, event.dt);
+         break;
+      case OpusLogEventType::fast_forward:
+         ok = read(is, event.dt) && read(is, event.step_size);
+         break;
+      case OpusLogEventType::create:
+      case OpusLogEventType::erase:
+         ok = read(is, event.id);
+         break;
+      case OpusLogEventType::child:
+         ok = read(is, event.id) && read(is, event.other_id) && read(is, event.priority);
+         break;
+      case OpusLogEventType::parent:
+         ok = read(is, event.id) && read(is, event.other_id);
+         break;
+      case OpusLogEventType::priority:
+         ok = read(is, event.id) && read(is, event.priority);
+         break;
+      default:
+         ok = false;
+         break;
+   }
+
+   if (!ok) {
+      valid_ = false;
+   }
+   return ok;
+}
+
+} // be::op
+} // be
@@ -0,0 +1,233 @@
+#include "pch.hpp"
+#include "opus_shards.hpp"
+
+namespace be {
+namespace op {
+namespace {
+
+thread_local std::size_t current_shard = OpusShards::no_shard;
+
+} // be::op::()
+
+constexpr std::size_t OpusShards::no_shard;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Creates a set of independent Opus instances, each of which is
+///         run on its own dedicated thread.
+///
+/// \details Each pair of shards is connected by a single-producer,
+///         single-consumer mailbox (in each direction) which can hold
+///         mailbox_capacity messages.  Shards only run when operator() is
+///         called; between ticks their threads sleep.
+OpusShards::OpusShards(std::size_t shards, std::size_t mailbox_capacity, op_generator op_gen)
+   : generation_(0),
+     running_(0),
+     dt_(0),
+     stopping_(false)
+{
+   if (shards == 0) {
+      shards = 1;
+   }
+
+   shards_.reserve(shards);
+   for (std::size_t i = 0; i < shards; ++i) {
+      shards_.emplace_back(new shard(op_gen));
+   }
+
+   mailboxes_.reserve(shards * shards);
+   for (std::size_t i = 0; i < shards * shards; ++i) {
+      mailboxes_.emplace_back(new mailbox(mailbox_capacity));
+   }
+   deliveries_.resize(shards * shards, 0);
+
+   for (std::size_t i = 0; i < shards; ++i) {
+      shards_[i]->thread = std::thread([this, i]() { run_(i); });
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Stops all shard threads.  Messages and migrations which have not
+///         been delivered are discarded.
+OpusShards::~OpusShards() {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+   }
+   start_cv_.notify_all();
+   for (auto& s : shards_) {
+      s->thread.join();
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t OpusShards::size() const {
+   return shards_.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Retrieves a shard's Opus.
+///
+/// \details The Opus must only be accessed from its own shard's thread while
+///         a tick is running (see current()), or from the thread which calls
+///         operator() between ticks.
+Opus& OpusShards::operator[](std::size_t shard) {
+   return shards_[shard]->opus;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the platform handle of a shard's thread, so that it can
+///         be pinned to a core or given a priority (e.g. with
+///         pthread_setaffinity_np() or SetThreadAffinityMask()).
+///
+/// \details The thread runs for the lifetime of the OpusShards object.
+std::thread::native_handle_type OpusShards::native_handle(std::size_t shard) {
+   return shards_[shard]->thread.native_handle();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Runs one tick of every shard in parallel, and returns once all of
+///         them have finished.
+///
+/// \details Each shard first runs the messages it has received from other
+///         shards, in order of sender index and then send order, then runs
+///         its Opus, then sends any ops it has been asked to migrate.  The
+///         number of messages waiting in each mailbox is recorded before any
+///         shard starts, and each shard only delivers that many, so messages
+///         and migrations sent during a tick (even by a message) are always
+///         delivered at the start of the next one, regardless of thread
+///         timing.  In particular, a migrated op never runs twice in one
+///         tick.
+F64 OpusShards::operator()(F64 dt) {
+   std::unique_lock<std::mutex> lock(mutex_);
+   for (std::size_t i = 0; i < mailboxes_.size(); ++i) {
+      deliveries_[i] = mailboxes_[i]->size();
+   }
+   dt_ = dt;
+   running_ = shards_.size();
+   ++generation_;
+   start_cv_.notify_all();
+   done_cv_.wait(lock, [this]() { return running_ == 0; });
+   return dt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Queues a function to be run on shard to's Opus at the start of
+///         its next tick.
+///
+/// \details Must only be called from shard from's thread while a tick is
+///         running, or from the thread which calls operator() between ticks,
+///         so that each mailbox only ever has one producer at a time.
+///
+/// \return false if the mailbox is full; msg is not sent.
+bool OpusShards::send(std::size_t from, std::size_t to, message msg) {
+   return mailbox_(from, to).try_push(std::move(msg));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Moves an op and its descendants from one shard to another,
+///         keeping their Ids.
+///
+/// \details The op is extracted (see Opus::extract()) after shard from
+///         finishes its current tick, and adopted as a child of parent_id
+///         at the start of shard to's next tick, so it does not run while
+///         it is in transit.  If the mailbox is full, the migration is
+///         retried after each subsequent tick.  Ops waiting on one of shard
+///         from's signals wait on shard to's signal with the same Id instead
+///         (see Opus::adopt()).  The same threading rules as send() apply.
+void OpusShards::migrate(std::size_t from, std::size_t to, Id id, Id parent_id) {
+   shards_[from]->migrations.push_back(migration { to, id, parent_id });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Returns the index of the shard running on the calling thread, or
+///         no_shard if called from any other thread.
+std::size_t OpusShards::current() {
+   return current_shard;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t OpusShards::default_size() {
+   std::size_t n = std::thread::hardware_concurrency();
+   return n > 0 ? n : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+OpusShards::mailbox& OpusShards::mailbox_(std::size_t from, std::size_t to) {
+   return *mailboxes_[mailbox_index_(from, to)];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::size_t OpusShards::mailbox_index_(std::size_t from, std::size_t to) const {
+   return to * shards_.size() + from;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusShards::run_(std::size_t index) {
+   current_shard = index;
+   U64 generation = 0;
+
+   for (;;) {
+      F64 dt;
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         start_cv_.wait(lock, [&]() { return stopping_ || generation_ != generation; });
+         if (stopping_) {
+            return;
+         }
+         generation = generation_;
+         dt = dt_;
+      }
+
+      tick_(index, dt);
+
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (--running_ == 0) {
+            done_cv_.notify_one();
+         }
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void OpusShards::tick_(std::size_t index, F64 dt) {
+   shard& s = *shards_[index];
+
+   message msg;
+   for (std::size_t from = 0, n = shards_.size(); from < n; ++from) {
+      mailbox& box = mailbox_(from, index);
+      for (std::size_t count = deliveries_[mailbox_index_(from, index)]; count > 0 && box.try_pop(msg); --count) {
+         msg(s.opus);
+         msg = message();
+      }
+   }
+
+   s.opus(dt);
+
+   if (!s.migrations.empty()) {
+      std::vector<migration> migrations;
+      std::swap(migrations, s.migrations);
+      for (migration& m : migrations) {
+         if (!s.opus.exists(m.id)) {
+            continue;
+         }
+
+         mailbox& box = mailbox_(index, m.to);
+         if (box.size() >= box.capacity()) {
+            s.migrations.push_back(m);
+            continue;
+         }
+
+         auto subtree = std::make_shared<OpSubtree>(s.opus.extract(m.id));
+         if (subtree->empty()) {
+            continue;
+         }
+
+         Id parent_id = m.parent_id;
+         box.try_push([=](Opus& opus) { opus.adopt(std::move(*subtree), parent_id); });
+      }
+   }
+}
+
+} // be::op
+} // be
@@ -0,0 +1,136 @@
+#include "opus.hpp"
+#include "opus_recorder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+using namespace be;
+using namespace be::op;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Stands in for a real action: busy-waits for a fixed number of
+///         nanoseconds, then runs its children like op::detail::StaticSet.
+struct StubAction : detail::OpFunc<StubAction> {
+   explicit StubAction(U64 cost_ns) : cost_ns(cost_ns) { }
+
+   void operator()(OpData& data, F64& dt) {
+      if (cost_ns > 0 && dt != 0) {
+         auto end = clock_type::now() + std::chrono::nanoseconds(cost_ns);
+         while (clock_type::now() < end) { }
+      }
+      detail::StaticSet()(data, dt);
+   }
+
+   U64 cost_ns;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+int usage() {
+   std::cerr << "Usage: opus_replay <log> [--cost <ns per op>] [--root-cost <ns>]" << std::endl;
+   return 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+F64 percentile(std::vector<F64>& values, F64 p) {
+   if (values.empty()) {
+      return 0;
+   }
+   std::size_t n = (std::size_t)(p * (values.size() - 1) + 0.5);
+   std::nth_element(values.begin(), values.begin() + n, values.end());
+   return values[n];
+}
+
+} // ()
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Replays a log written by op::OpusRecorder against stub actions
+///         with configurable costs, and reports tick time and clean_()
+///         statistics.
+int main(int argc, char** argv) {
+   if (argc < 2) {
+      return usage();
+   }
+
+   U64 cost_ns = 0;
+   U64 root_cost_ns = 0;
+   for (int i = 2; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--cost") == 0 && i + 1 < argc) {
+         cost_ns = std::strtoull(argv[++i], nullptr, 10);
+      } else if (std::strcmp(argv[i], "--root-cost") == 0 && i + 1 < argc) {
+         root_cost_ns = std::strtoull(argv[++i], nullptr, 10);
+      } else {
+         return usage();
+      }
+   }
+
+   std::ifstream ifs(argv[1], std::ios::binary);
+   OpusLogReader reader(ifs);
+   if (!reader.valid()) {
+      std::cerr << "Not a valid opus log: " << argv[1] << std::endl;
+      return 1;
+   }
+
+   Opus opus([=](Id id) {
+      Op op;
+      op.action(StubAction((U64)id ? cost_ns : root_cost_ns));
+      return op;
+   });
+
+   std::vector<F64> tick_times;
+   U64 events = 0;
+   F64 mutation_seconds = 0;
+
+   OpusLogEvent event;
+   while (reader.next(event)) {
+      ++events;
+      auto start = clock_type::now();
+      event.apply(opus);
+      F64 seconds = std::chrono::duration<F64>(clock_type::now() - start).count();
+
+      if (event.type == OpusLogEventType::tick || event.type == OpusLogEventType::fast_forward) {
+         tick_times.push_back(seconds);
+      } else {
+         mutation_seconds += seconds;
+      }
+   }
+
+   // next() stops at the end of the log as well as at a bad event; only
+   // the latter invalidates the reader
+   if (!reader.valid()) {
+      std::cerr << "Warning: log is truncated or corrupt after " << events << " events" << std::endl;
+   }
+
+   F64 total = std::accumulate(tick_times.begin(), tick_times.end(), 0.0);
+   OpusMetricsSnapshot stats = opus.metrics().snapshot();
+
+   std::cout << std::fixed << std::setprecision(3)
+             << "events:         " << events << '\n'
+             << "ticks:          " << tick_times.size() << '\n'
+             << "ops at end:     " << std::distance(opus.descendants_begin(Id()), opus.descendants_end(Id())) << '\n'
+             << "mutations:      " << mutation_seconds * 1000 << " ms\n"
+             << "tick total:     " << total * 1000 << " ms\n"
+             << "tick mean:      " << (tick_times.empty() ? 0 : total / tick_times.size()) * 1e6 << " us\n"
+             << "tick p50:       " << percentile(tick_times, 0.5) * 1e6 << " us\n"
+             << "tick p99:       " << percentile(tick_times, 0.99) * 1e6 << " us\n"
+             << "tick max:       " << percentile(tick_times, 1) * 1e6 << " us\n"
+             << "ops invoked:    " << stats.ops_invoked << '\n'
+             << "ops created:    " << stats.ops_created << '\n'
+             << "ops destroyed:  " << stats.ops_destroyed << '\n'
+             << "clean passes:   " << stats.cleans << '\n'
+             << "lists sorted:   " << stats.parents_sorted << '\n'
+             << "entries sorted: " << stats.children_sorted << '\n'
+             << "clean total:    " << stats.clean_ns_total * 1e-6 << " ms\n"
+             << "clean max:      " << stats.clean_ns_max * 1e-3 << " us" << std::endl;
+
+   return 0;
+}